@@ -0,0 +1,177 @@
+#include "analytics.h"
+#include "io.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+/* Fields of a record. Everything before MIN_BOIDS is summed */
+#define SUM_VX 0
+#define SUM_VY 1
+#define SUM_V2 2
+#define SUM_NEIGHBORS 3
+#define SUM_BOIDS 4
+#define MIN_BOIDS 5
+#define MAX_BOIDS 6
+#define NUM_FIELDS 7
+
+#define CSV_HEADER "tick,order,mean_neighbors,min_boids,max_boids,kinetic_energy,velocity_variance\n"
+
+/*
+ * State of the analytics stage. The record being reduced and its result have to stay
+ * put until the reduction finishes, a tick or more later, so they are statics too
+ */
+static MPI_Comm comm;
+static MPI_Datatype record_type;
+static MPI_Op record_op;
+static MPI_Request request = MPI_REQUEST_NULL;
+static FILE* out;
+static int every;
+static int pending_tick;
+static int myrank;
+static double boid_v;
+static double scale_v;
+static double scale_v2;
+static int64_t local[NUM_FIELDS];
+static int64_t global[NUM_FIELDS];
+
+/* Writes the finished reduction */
+static void WriteRecord(void);
+
+/*
+ * The reduction for a whole record. It is one element of record_type, so MPI never
+ * hands this only part of a record
+ */
+static void
+CombineRecords(void* in, void* inout, int* len, MPI_Datatype* type)
+{
+    int r, f;
+    int64_t* a = (int64_t*) in;
+    int64_t* b = (int64_t*) inout;
+    (void) type;
+
+    for (r = 0; r < *len; ++r, a += NUM_FIELDS, b += NUM_FIELDS) {
+        for (f = 0; f < MIN_BOIDS; ++f)
+            b[f] += a[f];
+        if (a[MIN_BOIDS] < b[MIN_BOIDS])
+            b[MIN_BOIDS] = a[MIN_BOIDS];
+        if (a[MAX_BOIDS] > b[MAX_BOIDS])
+            b[MAX_BOIDS] = a[MAX_BOIDS];
+    }
+}
+
+/*
+ * Largest power of two that keeps n values of up to bound summing below 2^62. Powers
+ * of two, since multiplying by them is exact
+ */
+static double
+FixedScale(int n, double bound)
+{
+    int e;
+
+    if (n <= 0 || bound <= 0.0)
+        return ldexp(1.0, 40);
+    frexp(n * bound, &e);
+    return ldexp(1.0, 62 - e);
+}
+
+/*
+ * Sets up the record type and reduction, and has rank 0 start the CSV. Velocities are
+ * never longer than about v, which bounds the sums and so picks the fixed point scales
+ */
+void
+AnalyticsOpen(char* fname, int analytics_every, int numboids, double v, int first_tick,
+              MPI_Comm c)
+{
+    comm = c;
+    every = analytics_every;
+    boid_v = v;
+    if (every <= 0)
+        return;
+
+    MPI_Comm_rank(comm, &myrank);
+    scale_v = FixedScale(numboids, 1.02 * v);
+    scale_v2 = FixedScale(numboids, 1.05 * v * v);
+
+    MPI_Type_contiguous(NUM_FIELDS, MPI_INT64_T, &record_type);
+    MPI_Type_commit(&record_type);
+    MPI_Op_create(CombineRecords, 1, &record_op);
+
+    if (myrank == 0)
+        out = OpenTickLog(fname, CSV_HEADER, first_tick);
+}
+
+/*
+ * On recorded ticks, finishes the previous reduction, which has had every tick since to
+ * complete, then starts this one. Each boid's velocity is rounded to fixed point on its
+ * own, and integer sums don't depend on order, so neither the rank count nor the order
+ * boids sit in changes the result
+ */
+void
+AnalyticsTick(Boid* boids, int n, long long neighbors, int ticknum)
+{
+    int i;
+    int64_t vx = 0, vy = 0, v2 = 0;
+
+    if (every <= 0 || ticknum % every != 0)
+        return;
+
+    if (request != MPI_REQUEST_NULL) {
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        WriteRecord();
+    }
+
+    #pragma omp parallel for reduction(+:vx, vy, v2)
+    for (i = 0; i < n; ++i) {
+        vx += llrint(boids[i].v.x * scale_v);
+        vy += llrint(boids[i].v.y * scale_v);
+        v2 += llrint((boids[i].v.x * boids[i].v.x + boids[i].v.y * boids[i].v.y) * scale_v2);
+    }
+
+    local[SUM_VX] = vx;
+    local[SUM_VY] = vy;
+    local[SUM_V2] = v2;
+    local[SUM_NEIGHBORS] = neighbors;
+    local[SUM_BOIDS] = n;
+    local[MIN_BOIDS] = n;
+    local[MAX_BOIDS] = n;
+
+    pending_tick = ticknum;
+    MPI_Iallreduce(local, global, 1, record_type, record_op, comm, &request);
+}
+
+/* The order parameter is |sum of v| / (N v), as in Tamas's paper */
+static void
+WriteRecord(void)
+{
+    double n = (double) global[SUM_BOIDS];
+    double vx = global[SUM_VX] / scale_v;
+    double vy = global[SUM_VY] / scale_v;
+    double v2 = global[SUM_V2] / scale_v2;
+
+    if (myrank != 0 || !out || n <= 0)
+        return;
+
+    fprintf(out, "%i,%.9f,%.6f,%lld,%lld,%.9e,%.9e\n", pending_tick,
+            sqrt(vx * vx + vy * vy) / (n * boid_v), global[SUM_NEIGHBORS] / n,
+            (long long) global[MIN_BOIDS], (long long) global[MAX_BOIDS], 0.5 * v2 / n,
+            v2 / n - (vx * vx + vy * vy) / (n * n));
+}
+
+void
+AnalyticsClose(void)
+{
+    if (every <= 0)
+        return;
+
+    if (request != MPI_REQUEST_NULL) {
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        WriteRecord();
+    }
+
+    if (out)
+        fclose(out);
+    out = NULL;
+    MPI_Op_free(&record_op);
+    MPI_Type_free(&record_type);
+}
@@ -0,0 +1,24 @@
+#ifndef _ANALYTICS_H_
+#define _ANALYTICS_H_
+
+#include "boid.h"
+#include <mpi.h>
+
+/* In-situ analytics. Every analytics_every ticks each rank packs its part of
+   the flock's summary numbers into one record, and a single MPI_Iallreduce
+   adds them up while the next ticks run. Rank 0 writes one CSV line per
+   record: tick, order parameter, mean neighbor count, least and most boids on
+   a rank, mean kinetic energy and velocity variance. Sums are kept in 64 bit
+   fixed point, so they come out the same for any number of ranks */
+
+/* Starts the CSV, keeping lines from before first_tick when restarting */
+void AnalyticsOpen(char*, int, int, double, int, MPI_Comm);
+
+/* Adds this rank's boids and neighbor count for a tick, if it's one to record.
+   Collective */
+void AnalyticsTick(Boid*, int, long long, int);
+
+/* Writes the last record and closes the CSV. Collective */
+void AnalyticsClose(void);
+
+#endif
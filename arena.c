@@ -0,0 +1,76 @@
+#include "arena.h"
+#include <stdlib.h>
+
+static long long allocations;
+
+/* Allocations can come from inside parallel regions, so the count is kept atomically */
+static void
+Count(void)
+{
+    #pragma omp atomic
+    ++allocations;
+}
+
+void*
+CountedMalloc(size_t size)
+{
+    Count();
+    return malloc(size);
+}
+
+void*
+CountedCalloc(size_t n, size_t size)
+{
+    Count();
+    return calloc(n, size);
+}
+
+void*
+CountedRealloc(void* p, size_t size)
+{
+    Count();
+    return realloc(p, size);
+}
+
+long long
+HeapAllocations(void)
+{
+    long long n;
+
+    #pragma omp atomic read
+    n = allocations;
+    return n;
+}
+
+void*
+BufferReserve(Buffer* b, size_t size)
+{
+    if (size > b->peak)
+        b->peak = size;
+    if (size > b->size || !b->data) {
+        b->size = size + size / 2 + 1024;
+        b->data = CountedRealloc(b->data, b->size);
+    }
+    return b->data;
+}
+
+/* Goes straight to the new size, since BufferReserve would add half again on top */
+void
+BufferGrow(Buffer* b)
+{
+    size_t size = GROW_HEADROOM * b->peak;
+
+    if (b->data && size > b->size) {
+        b->size = size;
+        b->data = CountedRealloc(b->data, b->size);
+    }
+}
+
+void
+BufferFree(Buffer* b)
+{
+    free(b->data);
+    b->data = NULL;
+    b->size = 0;
+    b->peak = 0;
+}
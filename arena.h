@@ -0,0 +1,41 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+/* Heap buffers that live for the whole run, and a count of every allocation the
+   simulation makes, so the timing report can show that ticks stop allocating
+   once the buffers have grown to fit. Anything a tick allocates goes through
+   BufferReserve or the Counted functions */
+
+/* A buffer that only ever grows, to half again what was asked for, so it is
+   reallocated a handful of times early on and then never again. Contents are
+   kept when it grows. peak is the most that was ever asked of it */
+typedef struct buffer_s {
+    void* data;
+    size_t size;
+    size_t peak;
+} Buffer;
+
+/* Buffers grown at the end of the warmup ticks get room for this many times
+   the most they held during them */
+#define GROW_HEADROOM 2
+
+/* Makes sure a buffer holds at least this many bytes, and returns its data */
+void* BufferReserve(Buffer*, size_t);
+
+/* Grows a buffer that is in use to GROW_HEADROOM times its peak */
+void BufferGrow(Buffer*);
+
+/* Frees a buffer */
+void BufferFree(Buffer*);
+
+/* malloc, calloc and realloc, counted */
+void* CountedMalloc(size_t);
+void* CountedCalloc(size_t, size_t);
+void* CountedRealloc(void*, size_t);
+
+/* Number of counted allocations so far on this rank */
+long long HeapAllocations(void);
+
+#endif
@@ -0,0 +1,193 @@
+#include "bench.h"
+#include "../simulator.h"
+#include "../init.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static void
+Usage(char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-n boids] [-d density] [-c cutoff] [-r reps] [-w warmup] [-t threads]\n"
+            "          [-o file] [-H] [config.ini]\n"
+            "  -n   Number of boids. 20000 without a config file\n"
+            "  -d   Boids per unit area, which sets the box size. 2 without a config file\n"
+            "  -c   Neighbor cutoff\n"
+            "  -r   Timed repetitions, 20 by default\n"
+            "  -w   Untimed repetitions first, 3 by default\n"
+            "  -t   OpenMP threads per rank\n"
+            "  -o   Output file for drivers that write, removed at the end. bench.out by default\n"
+            "  -H   Print the CSV header line first\n"
+            "Anything not given comes from the config file, or the defaults in io.c\n", prog);
+    exit(1);
+}
+
+static int
+CompareDoubles(const void* a, const void* b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Options win over the config file. Without one, the run is a square box at density 2
+ * with 20000 boids. The seed is fixed when the config leaves it random, so builds are
+ * compared on the same boids. I/O ranks are turned off, since they'd hide the output cost
+ */
+void
+BenchInit(Bench* b, int argc, char** argv)
+{
+    int opt, provided, header = 0;
+    int numboids = -1, threads = -1;
+    double density = -1.0, cutoff = -1.0;
+    char* out = "bench.out";
+
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Comm_size(MPI_COMM_WORLD, &b->numranks);
+    MPI_Comm_rank(MPI_COMM_WORLD, &b->myrank);
+
+    if (provided < MPI_THREAD_FUNNELED) {
+        if (b->myrank == 0)
+            fprintf(stderr, "This MPI doesn't support MPI_THREAD_FUNNELED, which OpenMP "
+                    "threads need\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    b->reps = 20;
+    b->warmup = 3;
+    while ((opt = getopt(argc, argv, "n:d:c:r:w:t:o:H")) != -1) {
+        switch (opt) {
+        case 'n':
+            numboids = atoi(optarg);
+            break;
+        case 'd':
+            density = atof(optarg);
+            break;
+        case 'c':
+            cutoff = atof(optarg);
+            break;
+        case 'r':
+            b->reps = atoi(optarg);
+            break;
+        case 'w':
+            b->warmup = atoi(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        case 'H':
+            header = 1;
+            break;
+        default:
+            Usage(argv[0]);
+        }
+    }
+    if (optind < argc - 1 || b->reps < 1 || b->warmup < 0)
+        Usage(argv[0]);
+
+    if (optind == argc - 1)
+        b->c = ReadConfig(argv[optind]);
+    else {
+        b->c = DefaultConfig();
+        b->c->numboids = 20000;
+        if (density <= 0.0)
+            density = 2.0;
+    }
+
+    if (numboids > 0)
+        b->c->numboids = numboids;
+    if (density > 0.0)
+        b->c->sidelen = b->c->sidelen_x = b->c->sidelen_y = sqrt(b->c->numboids / density);
+    if (b->c->sidelen_x <= 0.0)
+        b->c->sidelen_x = b->c->sidelen_y = b->c->sidelen;
+    if (cutoff > 0.0)
+        b->c->cutoff = cutoff;
+    if (threads >= 0)
+        b->c->threads = threads;
+    if (b->c->seed < 0)
+        b->c->seed = 1;
+    b->c->fname = out;
+    b->c->numticks = b->warmup + b->reps;
+    b->c->io_ranks = 0;
+    b->density = b->c->numboids / (b->c->sidelen_x * b->c->sidelen_y);
+
+#ifdef _OPENMP
+    if (b->c->threads > 0)
+        omp_set_num_threads(b->c->threads);
+#endif
+
+    if (header && b->myrank == 0)
+        printf(BENCH_CSV_HEADER);
+
+    Initialize(&b->boids, b->c, &b->mynumboids, b->myrank, b->numranks, MPI_COMM_WORLD);
+    InitializeSim(b->boids, b->c, b->myrank, b->mynumboids, b->numranks, MPI_COMM_WORLD);
+
+    b->times = (double*) calloc(b->reps, sizeof(double));
+    b->rep = 0;
+}
+
+int
+BenchNext(Bench* b)
+{
+    return b->rep < b->warmup + b->reps;
+}
+
+void
+BenchStart(Bench* b)
+{
+    MPI_Barrier(MPI_COMM_WORLD);
+    b->start = MPI_Wtime();
+}
+
+void
+BenchStop(Bench* b)
+{
+    double t = MPI_Wtime() - b->start;
+
+    if (b->rep >= b->warmup)
+        b->times[b->rep - b->warmup] = t;
+    ++b->rep;
+}
+
+/*
+ * Each repetition is charged to its slowest rank. Boids per second go by the median, which
+ * a stray slow repetition doesn't move
+ */
+void
+BenchFinish(Bench* b, char* name)
+{
+    int i, threads = 1;
+    double mean = 0.0;
+
+    MPI_Allreduce(MPI_IN_PLACE, b->times, b->reps, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    qsort(b->times, b->reps, sizeof(double), CompareDoubles);
+    for (i = 0; i < b->reps; ++i)
+        mean += b->times[i] / b->reps;
+
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+
+    if (b->myrank == 0)
+        printf("%s,%i,%i,%i,%.6g,%.6g,%i,%.6e,%.6e,%.6e,%.6e,%.6e\n", name, b->numranks,
+               threads, b->c->numboids, b->density, b->c->cutoff, b->reps, b->times[0],
+               b->times[b->reps / 2], mean, b->times[b->reps - 1],
+               b->c->numboids / b->times[b->reps / 2]);
+
+    FinalizeSim();
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (b->myrank == 0)
+        remove(b->c->fname);
+
+    free(b->times);
+    MPI_Finalize();
+}
@@ -0,0 +1,44 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include "../boid.h"
+#include "../io.h"
+#include <mpi.h>
+
+/* Shared harness for the benchmark drivers. Each driver sets up a run the way
+   main does, times one piece of a tick over a number of repetitions, and rank
+   0 prints a single CSV line, so results from different builds and rank counts
+   can be concatenated and compared. A repetition takes as long as its slowest
+   rank, and every statistic is over those per-repetition maxima */
+
+#define BENCH_CSV_HEADER "bench,ranks,threads,boids,density,cutoff,reps,min_s,median_s,mean_s,max_s,boids_per_s\n"
+
+typedef struct bench_s {
+    Config* c;
+    Boid* boids;
+    int mynumboids;
+    int myrank;
+    int numranks;
+    int reps;
+    int warmup;
+    int rep;            /* Counts warmup repetitions too */
+    double density;
+    double start;
+    double* times;
+} Bench;
+
+/* Starts MPI, reads the options and an optional config file, and sets up the
+   boids and simulator */
+void BenchInit(Bench*, int, char**);
+
+/* Whether there are repetitions left to run */
+int BenchNext(Bench*);
+
+/* Brackets the code being timed. BenchStart waits for every rank first */
+void BenchStart(Bench*);
+void BenchStop(Bench*);
+
+/* Prints the CSV line for a driver, finishes the simulator and MPI. Collective */
+void BenchFinish(Bench*, char*);
+
+#endif
@@ -0,0 +1,29 @@
+#include "bench.h"
+#include "../simulator.h"
+
+/*
+ * Times the halo exchange the way Iterate does it without overlap: picking out the boids
+ * each neighbor needs, SendRecvBoids, and putting them after the local boids
+ */
+int
+main(int argc, char** argv)
+{
+    Bench b;
+    Boid* send_boids;
+    Boid* neighbor_boids;
+    int* num_send;
+    int* send_displs;
+    int neighbor_total;
+
+    BenchInit(&b, argc, argv);
+    while (BenchNext(&b)) {
+        BenchStart(&b);
+        send_boids = PackHaloBoids(&num_send, &send_displs);
+        neighbor_boids = SendRecvBoids(send_boids, num_send, send_displs, &neighbor_total);
+        ConcatenateBoids(neighbor_boids, neighbor_total);
+        BenchStop(&b);
+    }
+    BenchFinish(&b, "halo");
+
+    return 0;
+}
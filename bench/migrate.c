@@ -0,0 +1,24 @@
+#include "bench.h"
+#include "../simulator.h"
+
+/*
+ * Times UpdatePosition, which moves every boid by dt and then migrates the ones that
+ * left their rank through RearrangeBoids and RecombineBoids. Velocities are left alone,
+ * so boids keep going straight and each repetition migrates about as many as a tick
+ * would. A bigger dt in the config sends more of them across
+ */
+int
+main(int argc, char** argv)
+{
+    Bench b;
+
+    BenchInit(&b, argc, argv);
+    while (BenchNext(&b)) {
+        BenchStart(&b);
+        UpdatePosition();
+        BenchStop(&b);
+    }
+    BenchFinish(&b, "migrate");
+
+    return 0;
+}
@@ -0,0 +1,23 @@
+#include "bench.h"
+#include "../simulator.h"
+
+/*
+ * Times writing one tick of output, one tick per repetition, to the -o file. That is
+ * WriteRankData for text output, or the binary trajectory writer with binary_output set
+ * in the config, where only every frames_per_write'th repetition actually writes
+ */
+int
+main(int argc, char** argv)
+{
+    Bench b;
+
+    BenchInit(&b, argc, argv);
+    while (BenchNext(&b)) {
+        BenchStart(&b);
+        WriteOutput(b.rep);
+        BenchStop(&b);
+    }
+    BenchFinish(&b, "output");
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Strong scaling: the same number of boids on more and more ranks. Prints one
+# CSV line per driver and rank count, after a header, e.g.
+#   bench/strong.sh > strong-$(git rev-parse --short HEAD).csv
+# Settings come from the environment:
+#   BOIDS     total boids (200000)
+#   DENSITY   boids per unit area (2)
+#   REPS      timed repetitions per run (20)
+#   NPS       rank counts to run ("1 2 4 ..." up to the number of cores)
+#   DRIVERS   drivers to run ("tick velocity halo migrate output")
+#   CONFIG    config file for the other parameters (none)
+#   MPIRUN    launcher, with any flags it needs ("mpirun")
+dir=$(dirname "$0")
+BOIDS=${BOIDS:-200000}
+DENSITY=${DENSITY:-2}
+REPS=${REPS:-20}
+DRIVERS=${DRIVERS:-"tick velocity halo migrate output"}
+MPIRUN=${MPIRUN:-mpirun}
+if [ -z "$NPS" ]; then
+    cores=$(nproc 2>/dev/null || echo 1)
+    np=1
+    while [ "$np" -le "$cores" ]; do
+        NPS="$NPS $np"
+        np=$((np * 2))
+    done
+fi
+
+header=-H
+for np in $NPS; do
+    for d in $DRIVERS; do
+        $MPIRUN -np "$np" "$dir/$d" $header -n "$BOIDS" -d "$DENSITY" -r "$REPS" \
+            -o "bench-$d-$np.out" $CONFIG || exit 1
+        header=
+    done
+done
@@ -0,0 +1,22 @@
+#include "bench.h"
+#include "../simulator.h"
+
+/*
+ * Times whole ticks, as main runs them, for the scaling scripts. Output goes to the -o
+ * file, and analytics, clusters and load balancing run if the config turns them on
+ */
+int
+main(int argc, char** argv)
+{
+    Bench b;
+
+    BenchInit(&b, argc, argv);
+    while (BenchNext(&b)) {
+        BenchStart(&b);
+        Iterate(b.rep);
+        BenchStop(&b);
+    }
+    BenchFinish(&b, "tick");
+
+    return 0;
+}
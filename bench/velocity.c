@@ -0,0 +1,33 @@
+#include "bench.h"
+#include "../simulator.h"
+
+/*
+ * Times UpdateVelocity on its own. The halo is exchanged before every repetition but
+ * outside the timing, so the neighbor search sees the same boids it would in a tick.
+ * Positions never change, so every repetition searches the same layout
+ */
+int
+main(int argc, char** argv)
+{
+    Bench b;
+    Boid* send_boids;
+    Boid* neighbor_boids;
+    Boid* all_boids;
+    int* num_send;
+    int* send_displs;
+    int neighbor_total;
+
+    BenchInit(&b, argc, argv);
+    while (BenchNext(&b)) {
+        send_boids = PackHaloBoids(&num_send, &send_displs);
+        neighbor_boids = SendRecvBoids(send_boids, num_send, send_displs, &neighbor_total);
+        all_boids = ConcatenateBoids(neighbor_boids, neighbor_total);
+
+        BenchStart(&b);
+        UpdateVelocity(all_boids, neighbor_total);
+        BenchStop(&b);
+    }
+    BenchFinish(&b, "velocity");
+
+    return 0;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Weak scaling: the same number of boids per rank on more and more ranks, at a
+# fixed density, so the box grows with the rank count. Prints one CSV line per
+# driver and rank count, after a header, e.g.
+#   bench/weak.sh > weak-$(git rev-parse --short HEAD).csv
+# Settings come from the environment:
+#   PER_RANK  boids per rank (20000)
+#   DENSITY   boids per unit area (2)
+#   REPS      timed repetitions per run (20)
+#   NPS       rank counts to run ("1 2 4 ..." up to the number of cores)
+#   DRIVERS   drivers to run ("tick velocity halo migrate output")
+#   CONFIG    config file for the other parameters (none)
+#   MPIRUN    launcher, with any flags it needs ("mpirun")
+dir=$(dirname "$0")
+PER_RANK=${PER_RANK:-20000}
+DENSITY=${DENSITY:-2}
+REPS=${REPS:-20}
+DRIVERS=${DRIVERS:-"tick velocity halo migrate output"}
+MPIRUN=${MPIRUN:-mpirun}
+if [ -z "$NPS" ]; then
+    cores=$(nproc 2>/dev/null || echo 1)
+    np=1
+    while [ "$np" -le "$cores" ]; do
+        NPS="$NPS $np"
+        np=$((np * 2))
+    done
+fi
+
+header=-H
+for np in $NPS; do
+    for d in $DRIVERS; do
+        $MPIRUN -np "$np" "$dir/$d" $header -n $((PER_RANK * np)) -d "$DENSITY" -r "$REPS" \
+            -o "bench-$d-$np.out" $CONFIG || exit 1
+        header=
+    done
+done
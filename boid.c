@@ -1,5 +1,7 @@
 #include "boid.h"
+#include "arena.h"
 #include <math.h>
+#include <stdlib.h>
 
 /* Returns the distance between two boids */
 double
@@ -9,3 +11,134 @@ BoidDist(Boid b1, Boid b2)
     double dy = b2.r.y - b1.r.y;
     return sqrt(dx * dx + dy * dy);
 }
+
+/* Reallocates the arrays to hold capacity boids. Old contents are not kept */
+static void
+Resize(BoidArrays* a, int capacity)
+{
+    BoidArraysFree(a);
+    a->capacity = capacity;
+    a->x = (double*) CountedMalloc( a->capacity * sizeof(double) );
+    a->y = (double*) CountedMalloc( a->capacity * sizeof(double) );
+    a->vx = (double*) CountedMalloc( a->capacity * sizeof(double) );
+    a->vy = (double*) CountedMalloc( a->capacity * sizeof(double) );
+    a->id = (unsigned int*) CountedMalloc( a->capacity * sizeof(unsigned int) );
+}
+
+/* Grows the arrays to hold at least n boids. Old contents are not kept */
+void
+BoidArraysReserve(BoidArrays* a, int n)
+{
+    if (n > a->peak)
+        a->peak = n;
+    if (n > a->capacity)
+        Resize(a, n + n / 2);
+}
+
+void
+BoidArraysGrow(BoidArrays* a)
+{
+    if (a->capacity > 0 && GROW_HEADROOM * a->peak > a->capacity)
+        Resize(a, GROW_HEADROOM * a->peak);
+}
+
+/* Unpacks n boids into the arrays */
+void
+BoidsToArrays(Boid* b, int n, BoidArrays* a)
+{
+    int i;
+    BoidArraysReserve(a, n);
+    for (i = 0; i < n; ++i) {
+        a->x[i] = b[i].r.x;
+        a->y[i] = b[i].r.y;
+        a->vx[i] = b[i].v.x;
+        a->vy[i] = b[i].v.y;
+        a->id[i] = b[i].id;
+    }
+    a->n = n;
+}
+
+/*
+ * Inner loop of the velocity update. Compares squared distances so there is no sqrt,
+ * and has no branches, so with -fopenmp-simd GCC and Clang turn it into AVX2/AVX-512
+ * compares and masked adds. Velocities are rounded to fixed point at scale before they
+ * are added, and integer sums come out the same in any order, so the simd pragma can
+ * reorder them without changing the result
+ */
+int
+BoidArraysSum(BoidArrays* a, int lo, int hi, double x, double y, double cutoff2,
+              double scale, long long* vx, long long* vy)
+{
+    const double* restrict ax = a->x;
+    const double* restrict ay = a->y;
+    const double* restrict avx = a->vx;
+    const double* restrict avy = a->vy;
+    double dx, dy;
+    long long sx = 0, sy = 0;
+    int j, in, n = 0;
+
+    #pragma omp simd reduction(+:n, sx, sy) private(dx, dy, in)
+    for (j = lo; j < hi; ++j) {
+        dx = ax[j] - x;
+        dy = ay[j] - y;
+        in = dx * dx + dy * dy < cutoff2;
+        n += in;
+        sx += in ? llrint(avx[j] * scale) : 0;
+        sy += in ? llrint(avy[j] * scale) : 0;
+    }
+
+    *vx += sx;
+    *vy += sy;
+    return n;
+}
+
+/*
+ * BoidArraysSum for a Verlet list. The loads become gathers, but it vectorizes the
+ * same way, and what a boid's neighbors add up to doesn't depend on when its list was
+ * built or which rank built it
+ */
+int
+BoidArraysSumList(BoidArrays* a, int* list, int n, double x, double y, double cutoff2,
+                  double scale, long long* vx, long long* vy)
+{
+    const double* restrict ax = a->x;
+    const double* restrict ay = a->y;
+    const double* restrict avx = a->vx;
+    const double* restrict avy = a->vy;
+    double dx, dy;
+    long long sx = 0, sy = 0;
+    int j, k, in, count = 0;
+
+    #pragma omp simd reduction(+:count, sx, sy) private(j, dx, dy, in)
+    for (k = 0; k < n; ++k) {
+        j = list[k];
+        dx = ax[j] - x;
+        dy = ay[j] - y;
+        in = dx * dx + dy * dy < cutoff2;
+        count += in;
+        sx += in ? llrint(avx[j] * scale) : 0;
+        sy += in ? llrint(avy[j] * scale) : 0;
+    }
+
+    *vx += sx;
+    *vy += sy;
+    return count;
+}
+
+/* Frees the arrays */
+void
+BoidArraysFree(BoidArrays* a)
+{
+    free(a->x);
+    free(a->y);
+    free(a->vx);
+    free(a->vy);
+    free(a->id);
+    a->x = NULL;
+    a->y = NULL;
+    a->vx = NULL;
+    a->vy = NULL;
+    a->id = NULL;
+    a->n = 0;
+    a->capacity = 0;
+}
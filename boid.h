@@ -12,6 +12,40 @@ typedef struct boid_s {
     unsigned int id;
 } Boid;
 
+/* The same boids stored as a structure of arrays, so loops over them can be
+   vectorized. Only used for scratch copies, MPI always sees Boid arrays */
+typedef struct boidarrays_s {
+    double* x;
+    double* y;
+    double* vx;
+    double* vy;
+    unsigned int* id;
+    int n;
+    int capacity;
+    int peak;
+} BoidArrays;
+
 double BoidDist(Boid b1, Boid b2);
 
+/* Makes sure a BoidArrays has room for at least n boids */
+void BoidArraysReserve(BoidArrays* a, int n);
+
+/* Grows arrays that are in use to GROW_HEADROOM times the most boids asked of them */
+void BoidArraysGrow(BoidArrays* a);
+
+/* Unpacks n boids into the arrays */
+void BoidsToArrays(Boid* b, int n, BoidArrays* a);
+
+/* Adds the velocities of boids lo..hi-1 closer than sqrt(cutoff2) to (x, y) onto vx and
+   vy, rounded to fixed point at scale so the order they're added in doesn't matter */
+int BoidArraysSum(BoidArrays* a, int lo, int hi, double x, double y, double cutoff2,
+                  double scale, long long* vx, long long* vy);
+
+/* Same as BoidArraysSum, but over the n boids whose indices are listed */
+int BoidArraysSumList(BoidArrays* a, int* list, int n, double x, double y, double cutoff2,
+                      double scale, long long* vx, long long* vy);
+
+/* Frees the arrays */
+void BoidArraysFree(BoidArrays* a);
+
 #endif
@@ -0,0 +1,269 @@
+#include "cell.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <math.h>
+
+/* Reallocates the per boid arrays to hold capacity boids. Old contents are not kept */
+static void
+ResizeBoids(CellList* cl, int capacity)
+{
+    free(cl->index);
+    free(cl->cell_of);
+    cl->boid_capacity = capacity;
+    cl->index = (int*) CountedMalloc( cl->boid_capacity * sizeof(int) );
+    cl->cell_of = (int*) CountedMalloc( cl->boid_capacity * sizeof(int) );
+}
+
+/* Makes room for n boids. Old contents are not kept */
+static void
+ReserveBoids(CellList* cl, int n)
+{
+    if (n > cl->boid_peak)
+        cl->boid_peak = n;
+    if (n > cl->boid_capacity)
+        ResizeBoids(cl, n + n / 2);
+}
+
+/*
+ * Builds the cell list. The grid spans the box [xmin, xmax] x [ymin, ymax], which the
+ * caller extends by cutoff past the rank's own boundaries so halo boids get binned too.
+ * Cells are made as small as possible while staying at least cutoff wide, so every
+ * neighbor of a boid is guaranteed to be in the 3x3 block of cells around it. Boids
+ * falling outside the grid are too far from any local boid to matter, and are dropped
+ *
+ * Buffers are kept between calls and only grown, since the grid and boid counts
+ * barely change from tick to tick
+ */
+void
+CellListBuild(CellList* cl, Boid* b, int n, double xmin, double xmax, double ymin,
+              double ymax, double cutoff)
+{
+    int i, k, c, sum, ncells;
+
+    cl->x0 = xmin;
+    cl->y0 = ymin;
+    cl->nx = (int) floor((xmax - xmin) / cutoff);
+    cl->ny = (int) floor((ymax - ymin) / cutoff);
+    if (cl->nx < 1) cl->nx = 1;
+    if (cl->ny < 1) cl->ny = 1;
+    cl->xw = (xmax - xmin) / cl->nx;
+    cl->yw = (ymax - ymin) / cl->ny;
+
+    ncells = cl->nx * cl->ny;
+    if (ncells + 1 > cl->cell_capacity) {
+        free(cl->start);
+        cl->cell_capacity = ncells + 1;
+        cl->start = (int*) CountedMalloc( cl->cell_capacity * sizeof(int) );
+    }
+    ReserveBoids(cl, n);
+
+    /* Count boids per cell, then turn the counts into starting offsets */
+    for (c = 0; c <= ncells; ++c)
+        cl->start[c] = 0;
+
+    for (i = 0; i < n; ++i) {
+        cl->cell_of[i] = CellListCell(cl, b[i].r.x, b[i].r.y);
+        if (cl->cell_of[i] >= 0)
+            cl->start[cl->cell_of[i]]++;
+    }
+
+    /* Inclusive prefix sum, so start[c] is one past the end of cell c */
+    sum = 0;
+    for (c = 0; c <= ncells; ++c) {
+        sum += cl->start[c];
+        cl->start[c] = sum;
+    }
+
+    /* Scatter back to front, walking each start[c] down to the beginning of cell c.
+       Going backwards keeps boids within a cell in their original order */
+    for (i = n - 1; i >= 0; --i) {
+        c = cl->cell_of[i];
+        if (c >= 0)
+            cl->index[--cl->start[c]] = i;
+    }
+
+    /* Gather the binned boids into cell order for the vectorized kernel */
+    n = cl->start[ncells];
+    BoidArraysReserve(&cl->sorted, n);
+    for (k = 0; k < n; ++k) {
+        i = cl->index[k];
+        cl->sorted.x[k] = b[i].r.x;
+        cl->sorted.y[k] = b[i].r.y;
+        cl->sorted.vx[k] = b[i].v.x;
+        cl->sorted.vy[k] = b[i].v.y;
+        cl->sorted.id[k] = b[i].id;
+    }
+    cl->sorted.n = n;
+}
+
+void
+CellListGrow(CellList* cl)
+{
+    if (cl->boid_capacity == 0)
+        return;
+
+    if (GROW_HEADROOM * cl->boid_peak > cl->boid_capacity)
+        ResizeBoids(cl, GROW_HEADROOM * cl->boid_peak);
+    BoidArraysGrow(&cl->sorted);
+}
+
+/* Returns the cell containing (x, y), or -1 if the position is off the grid */
+int
+CellListCell(CellList* cl, double x, double y)
+{
+    int cx = (int) floor((x - cl->x0) / cl->xw);
+    int cy = (int) floor((y - cl->y0) / cl->yw);
+
+    if (cx < 0 || cx >= cl->nx || cy < 0 || cy >= cl->ny)
+        return -1;
+
+    return cx + cy * cl->nx;
+}
+
+/*
+ * Scans the 3x3 block of cells around b, and sums the velocities of everything within
+ * cutoff. Since b is itself in the list it is counted, same as the brute force loop
+ */
+int
+CellListSum(CellList* cl, Boid* all_boids, Boid b, double cutoff, double scale,
+            long long* v_x, long long* v_y)
+{
+    int cx, cy, x, y, c, k, j;
+    int neighbors = 0;
+
+    cx = (int) floor((b.r.x - cl->x0) / cl->xw);
+    cy = (int) floor((b.r.y - cl->y0) / cl->yw);
+
+    *v_x = 0;
+    *v_y = 0;
+    for (y = cy - 1; y <= cy + 1; ++y) {
+        if (y < 0 || y >= cl->ny)
+            continue;
+        for (x = cx - 1; x <= cx + 1; ++x) {
+            if (x < 0 || x >= cl->nx)
+                continue;
+            c = x + y * cl->nx;
+            for (k = cl->start[c]; k < cl->start[c + 1]; ++k) {
+                j = cl->index[k];
+                if ( BoidDist(b, all_boids[j]) < cutoff ) {
+                    ++neighbors;
+                    *v_x += llrint(all_boids[j].v.x * scale);
+                    *v_y += llrint(all_boids[j].v.y * scale);
+                }
+            }
+        }
+    }
+
+    return neighbors;
+}
+
+/*
+ * Scans the 3x3 block of cells around (x, y) in the sorted arrays. The three cells of a
+ * row sit next to each other in memory, so this is three calls to the vectorized kernel
+ * rather than nine short loops
+ */
+int
+CellListSumArrays(CellList* cl, double x, double y, double cutoff2, double scale,
+                  long long* v_x, long long* v_y)
+{
+    int cx, cy, row, lo, hi;
+    int neighbors = 0;
+
+    cx = (int) floor((x - cl->x0) / cl->xw);
+    cy = (int) floor((y - cl->y0) / cl->yw);
+    lo = cx > 0 ? cx - 1 : 0;
+    hi = cx < cl->nx - 1 ? cx + 1 : cl->nx - 1;
+
+    *v_x = 0;
+    *v_y = 0;
+    for (row = cy - 1; row <= cy + 1; ++row) {
+        if (row < 0 || row >= cl->ny)
+            continue;
+        neighbors += BoidArraysSum(&cl->sorted, cl->start[lo + row * cl->nx],
+                                   cl->start[hi + row * cl->nx + 1], x, y, cutoff2, scale,
+                                   v_x, v_y);
+    }
+
+    return neighbors;
+}
+
+/*
+ * Scans the 3x3 block of cells around (x, y) in the sorted arrays, like CellListSumArrays,
+ * but picks out the boids rather than summing them, so a list of them can be kept. Counting
+ * first sizes the list
+ */
+int
+CellListNear(CellList* cl, double x, double y, double cutoff2, int* out)
+{
+    int cx, cy, row, lo, hi, k;
+    int n = 0;
+    double dx, dy;
+
+    cx = (int) floor((x - cl->x0) / cl->xw);
+    cy = (int) floor((y - cl->y0) / cl->yw);
+    lo = cx > 0 ? cx - 1 : 0;
+    hi = cx < cl->nx - 1 ? cx + 1 : cl->nx - 1;
+
+    for (row = cy - 1; row <= cy + 1; ++row) {
+        if (row < 0 || row >= cl->ny)
+            continue;
+        for (k = cl->start[lo + row * cl->nx]; k < cl->start[hi + row * cl->nx + 1]; ++k) {
+            dx = cl->sorted.x[k] - x;
+            dy = cl->sorted.y[k] - y;
+            if (dx * dx + dy * dy < cutoff2) {
+                if (out)
+                    out[n] = cl->index[k];
+                ++n;
+            }
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Scans the 3x3 block of cells around each of the first n boids, the same way CellListSum
+ * does, but hands every pair found to link instead of summing
+ */
+void
+CellListPairs(CellList* cl, Boid* all_boids, int n, double cutoff,
+              void (*link)(int, int, void*), void* data)
+{
+    int i, cx, cy, x, y, c, k, j;
+
+    for (i = 0; i < n; ++i) {
+        cx = (int) floor((all_boids[i].r.x - cl->x0) / cl->xw);
+        cy = (int) floor((all_boids[i].r.y - cl->y0) / cl->yw);
+
+        for (y = cy - 1; y <= cy + 1; ++y) {
+            if (y < 0 || y >= cl->ny)
+                continue;
+            for (x = cx - 1; x <= cx + 1; ++x) {
+                if (x < 0 || x >= cl->nx)
+                    continue;
+                c = x + y * cl->nx;
+                for (k = cl->start[c]; k < cl->start[c + 1]; ++k) {
+                    j = cl->index[k];
+                    if (j != i && BoidDist(all_boids[i], all_boids[j]) < cutoff)
+                        link(i, j, data);
+                }
+            }
+        }
+    }
+}
+
+/* Releases the grid and index buffers */
+void
+CellListFree(CellList* cl)
+{
+    free(cl->start);
+    free(cl->index);
+    free(cl->cell_of);
+    cl->start = NULL;
+    cl->index = NULL;
+    cl->cell_of = NULL;
+    BoidArraysFree(&cl->sorted);
+    cl->cell_capacity = 0;
+    cl->boid_capacity = 0;
+    cl->boid_peak = 0;
+}
@@ -0,0 +1,54 @@
+#ifndef _CELL_H_
+#define _CELL_H_
+
+#include "boid.h"
+
+/* Uniform grid of cells at least cutoff wide laid over a rank's subdomain plus
+   a halo ring of width cutoff. Boids are bucketed with a counting sort, so the
+   members of cell c are index[start[c]] .. index[start[c + 1] - 1]. sorted
+   holds a copy of the binned boids in that same order, so a row of cells is one
+   contiguous stretch of memory */
+typedef struct celllist_s {
+    double x0;
+    double y0;
+    double xw;
+    double yw;
+    int nx;
+    int ny;
+    int* start;
+    int* index;
+    int* cell_of;
+    BoidArrays sorted;
+    int cell_capacity;
+    int boid_capacity;
+    int boid_peak;
+} CellList;
+
+/* Bins boids into a grid covering [xmin, xmax] x [ymin, ymax] */
+void CellListBuild(CellList*, Boid*, int, double, double, double, double, double);
+
+/* Grows the cell list's boid arrays to GROW_HEADROOM times the most boids it has binned */
+void CellListGrow(CellList*);
+
+/* Returns the cell a position falls in, or -1 if it is outside the grid */
+int CellListCell(CellList*, double, double);
+
+/* Sums velocities of all boids within cutoff of b, in fixed point at the given scale.
+   Returns the neighbor count */
+int CellListSum(CellList*, Boid*, Boid, double, double, long long*, long long*);
+
+/* Same as CellListSum, but runs the vectorized kernel over the sorted arrays */
+int CellListSumArrays(CellList*, double, double, double, double, long long*, long long*);
+
+/* Writes the indices of all boids within sqrt(cutoff2) of (x, y) to out, or only counts
+   them if out is NULL. Returns how many there are */
+int CellListNear(CellList*, double, double, double, int*);
+
+/* Calls link(i, j, data) for every boid j within cutoff of each boid i < n,
+   other than i itself */
+void CellListPairs(CellList*, Boid*, int, double, void (*)(int, int, void*), void*);
+
+/* Frees the memory held by the cell list */
+void CellListFree(CellList*);
+
+#endif
@@ -0,0 +1,227 @@
+#include "checkpoint.h"
+#include "traj.h"
+#include "init.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+
+static volatile sig_atomic_t signalled;
+
+static void
+OnSignal(int sig)
+{
+    (void) sig;
+    signalled = 1;
+}
+
+/*
+ * Batch systems send SIGTERM some time before killing a job. Rather than dying, the run
+ * notes it, and the ranks agree at the end of the tick to checkpoint and stop
+ */
+void
+CheckpointCatchSignals(void)
+{
+    signal(SIGTERM, OnSignal);
+    signal(SIGUSR1, OnSignal);
+}
+
+int
+CheckpointSignalled(void)
+{
+    return signalled;
+}
+
+/*
+ * Writes the checkpoint to a temporary file, which rank 0 renames over the old one once
+ * every rank is done, so a job killed halfway through a checkpoint still has the last
+ * good one. Each rank's boids go right after those of lower ranks, found with an
+ * MPI_Exscan of the counts, in one MPI_File_write_at_all. Counts are in records and
+ * offsets in MPI_Offset, so neither overflows an int however many boids there are
+ */
+void
+CheckpointWrite(Config* c, Boid* boids, int n, int tick, MPI_Comm comm)
+{
+    int i, myrank;
+    long long before = 0, count = n;
+    char* tmp = (char*) malloc( strlen(c->checkpoint_file) + 5 );
+    TrajRecord* records = (TrajRecord*) malloc( (n > 0 ? n : 1) * sizeof(TrajRecord) );
+    CheckpointHeader header;
+    MPI_Datatype record_type;
+    MPI_File fh;
+
+    MPI_Comm_rank(comm, &myrank);
+    MPI_Type_contiguous(sizeof(TrajRecord), MPI_BYTE, &record_type);
+    MPI_Type_commit(&record_type);
+    sprintf(tmp, "%s.tmp", c->checkpoint_file);
+
+    MPI_Exscan(&count, &before, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    if (myrank == 0)
+        before = 0;
+
+    for (i = 0; i < n; ++i) {
+        records[i].id = boids[i].id;
+        records[i].pad = 0;
+        records[i].x = boids[i].r.x;
+        records[i].y = boids[i].r.y;
+        records[i].vx = boids[i].v.x;
+        records[i].vy = boids[i].v.y;
+    }
+
+    memset(&header, 0, sizeof(CheckpointHeader));
+    memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+    header.version = CHECKPOINT_VERSION;
+    header.record_size = sizeof(TrajRecord);
+    header.numboids = c->numboids;
+    header.tick = tick;
+    header.seed = c->seed;
+    header.v = c->v;
+    header.dt = c->dt;
+    header.noise = c->noise;
+    header.cutoff = c->cutoff;
+    header.sidelen_x = c->sidelen_x;
+    header.sidelen_y = c->sidelen_y;
+
+    MPI_File_open(comm, tmp, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    MPI_File_set_size(fh, 0);
+    if (myrank == 0)
+        MPI_File_write_at(fh, 0, &header, sizeof(CheckpointHeader), MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_write_at_all(fh, (MPI_Offset) sizeof(CheckpointHeader) +
+                          (MPI_Offset) before * sizeof(TrajRecord), records, n, record_type,
+                          MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    MPI_Type_free(&record_type);
+
+    if (myrank == 0) {
+        if (rename(tmp, c->checkpoint_file) != 0)
+            perror("Could not move checkpoint into place");
+        else
+            printf("Wrote checkpoint %s at tick %i\n", c->checkpoint_file, tick);
+    }
+
+    free(records);
+    free(tmp);
+}
+
+/*
+ * Rank 0 reads the header and shares it. Everything that defines the run is taken from
+ * the checkpoint, so it continues the same simulation, but numticks and every option
+ * that only changes how it is computed still come from the config file
+ */
+int
+CheckpointReadHeader(Config* c, MPI_Comm comm)
+{
+    int myrank, ok = 1;
+    CheckpointHeader header;
+    FILE* f;
+
+    MPI_Comm_rank(comm, &myrank);
+
+    if (myrank == 0) {
+        f = fopen(c->restart, "rb");
+        if (!f || fread(&header, sizeof(CheckpointHeader), 1, f) != 1 ||
+            memcmp(header.magic, CHECKPOINT_MAGIC, 8) != 0 ||
+            header.version != CHECKPOINT_VERSION || header.record_size != sizeof(TrajRecord)) {
+            fprintf(stderr, "%s is not a checkpoint this version can read\n", c->restart);
+            ok = 0;
+        }
+        if (f)
+            fclose(f);
+    }
+
+    MPI_Bcast(&ok, 1, MPI_INT, 0, comm);
+    if (!ok)
+        exit(1);
+    MPI_Bcast(&header, sizeof(CheckpointHeader), MPI_BYTE, 0, comm);
+
+    c->numboids = header.numboids;
+    c->seed = header.seed;
+    c->v = header.v;
+    c->dt = header.dt;
+    c->noise = header.noise;
+    c->cutoff = header.cutoff;
+    c->sidelen_x = header.sidelen_x;
+    c->sidelen_y = header.sidelen_y;
+
+    return header.tick;
+}
+
+/*
+ * Each rank reads an equal, contiguous slice of the records, whichever ranks wrote them,
+ * then sends every boid to the rank VecToRank says owns it on this job's grid, with one
+ * MPI_Alltoallv. The new job can have any number of ranks. Counts and displacements
+ * are in whole records and boids, so they fit in an int as long as each rank's share does
+ */
+void
+CheckpointRead(Config* c, Boid** boids, int* mynumboids, int myrank, int numranks,
+               MPI_Comm comm)
+{
+    int i, dims[2];
+    long long lo = (long long) c->numboids * myrank / numranks;
+    long long hi = (long long) c->numboids * (myrank + 1) / numranks;
+    int n = (int) (hi - lo);
+    TrajRecord* records = (TrajRecord*) malloc( (n > 0 ? n : 1) * sizeof(TrajRecord) );
+    Boid* mine = (Boid*) malloc( (n > 0 ? n : 1) * sizeof(Boid) );
+    Boid* sorted = (Boid*) malloc( (n > 0 ? n : 1) * sizeof(Boid) );
+    int* dest = (int*) malloc( (n > 0 ? n : 1) * sizeof(int) );
+    int* counts = (int*) calloc( 4 * numranks, sizeof(int) );
+    int* send_counts = counts;
+    int* send_displs = counts + numranks;
+    int* recv_counts = counts + 2 * numranks;
+    int* recv_displs = counts + 3 * numranks;
+    int* cursor = (int*) calloc( numranks, sizeof(int) );
+    MPI_Datatype record_type, boid_type;
+    MPI_File fh;
+
+    MPI_Type_contiguous(sizeof(TrajRecord), MPI_BYTE, &record_type);
+    MPI_Type_commit(&record_type);
+    MPI_Type_contiguous(sizeof(Boid), MPI_BYTE, &boid_type);
+    MPI_Type_commit(&boid_type);
+
+    RankDims(numranks, c->sidelen_x, c->sidelen_y, dims);
+    CheckRanks(myrank, dims, c);
+
+    MPI_File_open(comm, c->restart, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+    MPI_File_read_at_all(fh, (MPI_Offset) sizeof(CheckpointHeader) +
+                         (MPI_Offset) lo * sizeof(TrajRecord), records, n, record_type,
+                         MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+
+    for (i = 0; i < n; ++i) {
+        mine[i].id = records[i].id;
+        mine[i].r.x = records[i].x;
+        mine[i].r.y = records[i].y;
+        mine[i].v.x = records[i].vx;
+        mine[i].v.y = records[i].vy;
+        dest[i] = VecToRank(mine[i].r, c->sidelen_x, c->sidelen_y, dims);
+        send_counts[dest[i]]++;
+    }
+
+    /* Group by destination */
+    for (i = 1; i < numranks; ++i)
+        cursor[i] = cursor[i - 1] + send_counts[i - 1];
+    for (i = 0; i < n; ++i)
+        sorted[cursor[dest[i]]++] = mine[i];
+
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, comm);
+
+    *mynumboids = 0;
+    for (i = 0; i < numranks; ++i) {
+        send_displs[i] = (i > 0 ? send_displs[i - 1] + send_counts[i - 1] : 0);
+        recv_displs[i] = *mynumboids;
+        *mynumboids += recv_counts[i];
+    }
+
+    *boids = (Boid*) malloc( (*mynumboids > 0 ? *mynumboids : 1) * sizeof(Boid) );
+    MPI_Alltoallv(sorted, send_counts, send_displs, boid_type,
+                  *boids, recv_counts, recv_displs, boid_type, comm);
+
+    MPI_Type_free(&boid_type);
+    MPI_Type_free(&record_type);
+    free(cursor);
+    free(counts);
+    free(dest);
+    free(sorted);
+    free(mine);
+    free(records);
+}
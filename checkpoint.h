@@ -0,0 +1,49 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include "boid.h"
+#include "io.h"
+#include <stdint.h>
+#include <mpi.h>
+
+/* Checkpoint file. A CheckpointHeader holding the tick to resume at and the
+   parts of the Config that define the run, then numboids TrajRecords grouped
+   by the rank that wrote them. Random numbers only depend on the seed, boid
+   ids and the tick, so those are all the generator state there is */
+
+#define CHECKPOINT_MAGIC "PFLOCKCK"
+#define CHECKPOINT_VERSION 1
+
+typedef struct checkpointheader_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t numboids;
+    uint64_t tick;
+    int64_t seed;
+    double v;
+    double dt;
+    double noise;
+    double cutoff;
+    double sidelen_x;
+    double sidelen_y;
+} CheckpointHeader;
+
+/* Has SIGTERM and SIGUSR1 ask for a checkpoint instead of killing the run */
+void CheckpointCatchSignals(void);
+
+/* Whether one of those signals has come in on this rank */
+int CheckpointSignalled(void);
+
+/* Collectively writes every rank's boids, to resume at the given tick */
+void CheckpointWrite(Config*, Boid*, int, int, MPI_Comm);
+
+/* Reads a checkpoint's header into the config, and returns the tick to resume
+   at. Collective */
+int CheckpointReadHeader(Config*, MPI_Comm);
+
+/* Reads a checkpoint's boids in parallel and hands them to the ranks that own
+   them. Collective */
+void CheckpointRead(Config*, Boid**, int*, int, int, MPI_Comm);
+
+#endif
@@ -0,0 +1,296 @@
+#include "cluster.h"
+#include "arena.h"
+#include "io.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+
+#define CSV_HEADER "tick,size,count\n"
+
+static MPI_Comm comm;
+static FILE* out;
+static int every;
+static int myrank;
+static int numranks;
+
+/* Scratch space for ClustersWrite, kept between calls */
+static Buffer sizes_buffer;
+static Buffer spanning_buffer;
+static Buffer gather_counts;
+static Buffer gather_pairs;
+
+void
+ClustersOpen(char* fname, int cluster_every, int first_tick, MPI_Comm c)
+{
+    comm = c;
+    every = cluster_every;
+    if (every <= 0)
+        return;
+
+    MPI_Comm_rank(comm, &myrank);
+    MPI_Comm_size(comm, &numranks);
+    if (myrank == 0)
+        out = OpenTickLog(fname, CSV_HEADER, first_tick);
+}
+
+int
+ClustersDue(int ticknum)
+{
+    return every > 0 && ticknum % every == 0;
+}
+
+/* Reallocates the arrays to hold capacity boids. Old contents are not kept */
+static void
+Resize(Clusters* cl, int capacity)
+{
+    free(cl->parent);
+    free(cl->label);
+    free(cl->root_label);
+    free(cl->size);
+    cl->capacity = capacity;
+    cl->parent = (int*) CountedMalloc( cl->capacity * sizeof(int) );
+    cl->label = (unsigned int*) CountedMalloc( cl->capacity * sizeof(unsigned int) );
+    cl->root_label = (unsigned int*) CountedMalloc( cl->capacity * sizeof(unsigned int) );
+    cl->size = (int*) CountedMalloc( cl->capacity * sizeof(int) );
+}
+
+/* Makes room for n boids. Old contents are not kept */
+static void
+Reserve(Clusters* cl, int n)
+{
+    if (n > cl->peak)
+        cl->peak = n;
+    if (n > cl->capacity)
+        Resize(cl, n + n / 2);
+}
+
+void
+ClustersReset(Clusters* cl, Boid* all_boids, int n)
+{
+    int i;
+
+    Reserve(cl, n);
+    for (i = 0; i < n; ++i) {
+        cl->parent[i] = i;
+        cl->label[i] = all_boids[i].id;
+    }
+}
+
+/* Finds the root of i's cluster, halving the path to it on the way */
+static int
+Find(int* parent, int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+/*
+ * The root with the larger index goes under the other, so a cluster's root is always its
+ * lowest index. Local boids come first, so any cluster with a local boid has a local root
+ */
+void
+ClustersLink(int i, int j, void* data)
+{
+    Clusters* cl = (Clusters*) data;
+    int a = Find(cl->parent, i);
+    int b = Find(cl->parent, j);
+
+    if (a < b)
+        cl->parent[b] = a;
+    else if (b < a)
+        cl->parent[a] = b;
+}
+
+/*
+ * Halo boids carry whatever label their owner last sent, so a cluster that reaches across
+ * to another rank picks up that rank's smallest label, and passes its own along next round
+ */
+int
+ClustersRelabel(Clusters* cl, int n_all, int n_local)
+{
+    int i, r, changed = 0;
+    unsigned int l;
+
+    for (i = 0; i < n_all; ++i)
+        cl->root_label[i] = UINT_MAX;
+    for (i = 0; i < n_all; ++i) {
+        r = Find(cl->parent, i);
+        if (cl->label[i] < cl->root_label[r])
+            cl->root_label[r] = cl->label[i];
+    }
+
+    for (i = 0; i < n_local; ++i) {
+        l = cl->root_label[Find(cl->parent, i)];
+        if (l != cl->label[i]) {
+            cl->label[i] = l;
+            changed = 1;
+        }
+    }
+
+    return changed;
+}
+
+static int
+CompareLongLongPairs(const void* a, const void* b)
+{
+    const long long* x = (const long long*) a;
+    const long long* y = (const long long*) b;
+    return (x[0] > y[0]) - (x[0] < y[0]);
+}
+
+/*
+ * Sorts (key, count) pairs by key and adds up the counts of equal keys, in place. Returns
+ * how many pairs are left
+ */
+static int
+MergePairs(long long* pairs, int n)
+{
+    int i, m = 0;
+
+    qsort(pairs, n, 2 * sizeof(long long), CompareLongLongPairs);
+    for (i = 0; i < n; ++i) {
+        if (m > 0 && pairs[2 * (m - 1)] == pairs[2 * i])
+            pairs[2 * (m - 1) + 1] += pairs[2 * i + 1];
+        else {
+            pairs[2 * m] = pairs[2 * i];
+            pairs[2 * m + 1] = pairs[2 * i + 1];
+            ++m;
+        }
+    }
+
+    return m;
+}
+
+/*
+ * Gathers pairs from every rank onto rank 0, after the first offset pairs of
+ * gather_pairs. Returns the gathered pairs on rank 0 and sets n to how many there are.
+ * The result is only good until the next call
+ */
+static long long*
+GatherPairs(long long* pairs, int* n, int offset)
+{
+    int i, total = 0;
+    int count = 2 * *n;
+    int* counts = NULL;
+    int* displs = NULL;
+    long long* all = NULL;
+
+    if (myrank == 0) {
+        counts = (int*) BufferReserve(&gather_counts, 2 * numranks * sizeof(int));
+        displs = counts + numranks;
+    }
+    MPI_Gather(&count, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+
+    if (myrank == 0) {
+        for (i = 0; i < numranks; ++i) {
+            displs[i] = total;
+            total += counts[i];
+        }
+        all = (long long*) BufferReserve(&gather_pairs, (2 * offset + total + 2) *
+                                         sizeof(long long));
+        all += 2 * offset;
+    }
+    MPI_Gatherv(pairs, count, MPI_LONG_LONG, all, counts, displs, MPI_LONG_LONG, 0, comm);
+
+    *n = total / 2;
+    return all;
+}
+
+/*
+ * A cluster without halo boids can't reach any other rank, so its size is final and goes
+ * straight into this rank's histogram. Only clusters touching a neighbor are sent to rank
+ * 0 as (label, boids here) pairs, and added up there. Histograms go to rank 0 as (size,
+ * count) pairs, so nothing sent grows with the number of boids. Rank 0 gathers the
+ * spanning clusters after the histograms, with room to add them to the histogram's end
+ */
+void
+ClustersWrite(Clusters* cl, int n_all, int n_local, int ticknum)
+{
+    int i, r, num_sizes = 0, num_spanning = 0;
+    long long* sizes;
+    long long* spanning;
+    long long* all_sizes;
+    long long* all_spanning;
+
+    /* Reuses root_label to flag clusters reaching into the halo */
+    for (i = 0; i < n_all; ++i) {
+        cl->size[i] = 0;
+        cl->root_label[i] = 0;
+    }
+    for (i = 0; i < n_local; ++i)
+        cl->size[Find(cl->parent, i)]++;
+    for (i = n_local; i < n_all; ++i)
+        cl->root_label[Find(cl->parent, i)] = 1;
+
+    sizes = (long long*) BufferReserve(&sizes_buffer, 2 * n_local * sizeof(long long));
+    spanning = (long long*) BufferReserve(&spanning_buffer, 2 * n_local * sizeof(long long));
+    for (r = 0; r < n_local; ++r) {
+        if (cl->parent[r] != r)
+            continue;
+        if (cl->root_label[r]) {
+            spanning[2 * num_spanning] = cl->label[r];
+            spanning[2 * num_spanning + 1] = cl->size[r];
+            ++num_spanning;
+        }
+        else {
+            sizes[2 * num_sizes] = cl->size[r];
+            sizes[2 * num_sizes + 1] = 1;
+            ++num_sizes;
+        }
+    }
+    num_sizes = MergePairs(sizes, num_sizes);
+
+    all_sizes = GatherPairs(sizes, &num_sizes, 0);
+    all_spanning = GatherPairs(spanning, &num_spanning, 2 * num_sizes);
+
+    if (myrank == 0) {
+        /* Each label is one whole cluster now, so it adds one of its size. Spanning pairs
+           sit num_sizes pairs past the end of the sizes, so this never overtakes them */
+        all_sizes = (long long*) gather_pairs.data;
+        num_spanning = MergePairs(all_spanning, num_spanning);
+        for (i = 0; i < num_spanning; ++i) {
+            all_sizes[2 * num_sizes] = all_spanning[2 * i + 1];
+            all_sizes[2 * num_sizes + 1] = 1;
+            ++num_sizes;
+        }
+        num_sizes = MergePairs(all_sizes, num_sizes);
+
+        for (i = 0; out && i < num_sizes; ++i)
+            fprintf(out, "%i,%lld,%lld\n", ticknum, all_sizes[2 * i], all_sizes[2 * i + 1]);
+    }
+}
+
+void
+ClustersGrow(Clusters* cl)
+{
+    if (cl->capacity > 0 && GROW_HEADROOM * cl->peak > cl->capacity)
+        Resize(cl, GROW_HEADROOM * cl->peak);
+    BufferGrow(&sizes_buffer);
+    BufferGrow(&spanning_buffer);
+    BufferGrow(&gather_pairs);
+}
+
+void
+ClustersClose(Clusters* cl)
+{
+    if (out)
+        fclose(out);
+    out = NULL;
+
+    free(cl->parent);
+    free(cl->label);
+    free(cl->root_label);
+    free(cl->size);
+    BufferFree(&sizes_buffer);
+    BufferFree(&spanning_buffer);
+    BufferFree(&gather_counts);
+    BufferFree(&gather_pairs);
+    cl->parent = NULL;
+    cl->label = NULL;
+    cl->root_label = NULL;
+    cl->size = NULL;
+    cl->capacity = 0;
+}
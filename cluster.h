@@ -0,0 +1,54 @@
+#ifndef _CLUSTER_H_
+#define _CLUSTER_H_
+
+#include "boid.h"
+#include <mpi.h>
+
+/* Flock detection. Boids closer than cutoff are in the same cluster, and so
+   is anything connected to them through a chain of such pairs. Every
+   cluster_every ticks each rank joins up its own boids and the halo boids it
+   already has with a union-find, and every cluster takes the smallest boid id
+   in it as its label. Labels of halo boids come from the ranks that own them,
+   so they are traded with neighbors until no label changes anywhere. Only the
+   histogram of cluster sizes is written out */
+
+/* Union-find over a rank's boids followed by its halo boids. label is the
+   smallest id known to be in a boid's cluster */
+typedef struct clusters_s {
+    int* parent;
+    unsigned int* label;
+    unsigned int* root_label;
+    int* size;
+    int capacity;
+    int peak;
+} Clusters;
+
+/* Starts the cluster size CSV, keeping lines from before first_tick when
+   restarting */
+void ClustersOpen(char*, int, int, MPI_Comm);
+
+/* Whether cluster sizes are recorded at a tick */
+int ClustersDue(int);
+
+/* Puts every boid in a cluster of its own, labeled with its id */
+void ClustersReset(Clusters*, Boid*, int);
+
+/* Joins the clusters of boids i and j. Made to be handed to CellListPairs */
+void ClustersLink(int, int, void*);
+
+/* Relabels the first n_local boids with the smallest label in their cluster.
+   Returns whether any label changed */
+int ClustersRelabel(Clusters*, int, int);
+
+/* Adds up the sizes of clusters across ranks and writes the histogram for a
+   tick. Collective */
+void ClustersWrite(Clusters*, int, int, int);
+
+/* Grows the union-find and the histogram scratch to GROW_HEADROOM times the most
+   any tick so far has needed */
+void ClustersGrow(Clusters*);
+
+/* Closes the CSV and frees the union-find */
+void ClustersClose(Clusters*);
+
+#endif
@@ -0,0 +1,225 @@
+#include "exchange.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Capacity used for the next exchange, given the current one and the number of boids
+   that actually had to be sent. Grows with headroom as soon as something overflows,
+   but only shrinks when the blocks are mostly empty, so a count wobbling around the
+   capacity doesn't overflow every other tick */
+static int
+NextCapacity(int cap, int count)
+{
+    if (count > cap)
+        return count + count / 4 + 16;
+    if (count < cap / 4 && cap > 32)
+        return cap / 2;
+    return cap;
+}
+
+/* Reallocates a block buffer to size slots. Old contents are not kept */
+static Boid*
+ResizeBlocks(Boid* blocks, int* allocated, int size)
+{
+    free(blocks);
+    *allocated = size;
+    return (Boid*) CountedMalloc( (*allocated) * sizeof(Boid) );
+}
+
+/* Makes sure a block buffer has room for size slots, and keeps track of the most
+   it has been asked for */
+static Boid*
+ReserveBlocks(Boid* blocks, int* allocated, int* peak, int size)
+{
+    if (size > *peak)
+        *peak = size;
+    if (size <= *allocated)
+        return blocks;
+    return ResizeBlocks(blocks, allocated, size + size / 2);
+}
+
+/*
+ * Sets up an exchange with the n ranks listed in ranks, which must be the neighbors of
+ * comm in the same order. capacity is the starting block size, and has to be the same
+ * on every rank. Overflow messages are sent with tag, so separate exchanges on the same
+ * communicator need separate tags
+ */
+void
+ExchangeInit(Exchange* e, MPI_Comm comm, int* ranks, int n, int capacity, int tag)
+{
+    int i;
+
+    e->comm = comm;
+    e->tag = tag;
+    e->n = n;
+    e->ranks = ranks;
+    e->send_cap = (int*) CountedMalloc( n * sizeof(int) );
+    e->recv_cap = (int*) CountedMalloc( n * sizeof(int) );
+    e->num_recv = (int*) CountedMalloc( n * sizeof(int) );
+    e->bytes = (int*) CountedMalloc( 4 * n * sizeof(int) );
+    e->overflow_r = (MPI_Request*) CountedMalloc( n * sizeof(MPI_Request) );
+    e->send_blocks = NULL;
+    e->recv_blocks = NULL;
+    e->recv.data = NULL;
+    e->recv.size = 0;
+    e->send_size = 0;
+    e->recv_size = 0;
+    e->send_peak = 0;
+    e->recv_peak = 0;
+    e->num_overflow = 0;
+
+    for (i = 0; i < n; ++i) {
+        e->send_cap[i] = capacity;
+        e->recv_cap[i] = capacity;
+    }
+}
+
+/*
+ * Copies each neighbor's boids into its block, with the true count stored in the id of
+ * the block's first slot, and starts one MPI_Ineighbor_alltoallv for all of them.
+ * Whatever doesn't fit is sent straight from send with a point to point message
+ */
+void
+ExchangeStart(Exchange* e, Boid* send, int* num_send, int* displs)
+{
+    int i, inline_count, send_total = 0, recv_total = 0;
+    int* send_counts = e->bytes;
+    int* send_displs = e->bytes + e->n;
+    int* recv_counts = e->bytes + 2 * e->n;
+    int* recv_displs = e->bytes + 3 * e->n;
+
+    for (i = 0; i < e->n; ++i) {
+        send_counts[i] = (e->send_cap[i] + 1) * sizeof(Boid);
+        send_displs[i] = send_total * sizeof(Boid);
+        send_total += e->send_cap[i] + 1;
+
+        recv_counts[i] = (e->recv_cap[i] + 1) * sizeof(Boid);
+        recv_displs[i] = recv_total * sizeof(Boid);
+        recv_total += e->recv_cap[i] + 1;
+    }
+
+    e->send_blocks = ReserveBlocks(e->send_blocks, &e->send_size, &e->send_peak, send_total);
+    e->recv_blocks = ReserveBlocks(e->recv_blocks, &e->recv_size, &e->recv_peak, recv_total);
+
+    e->num_overflow = 0;
+    send_total = 0;
+    for (i = 0; i < e->n; ++i) {
+        inline_count = num_send[i] < e->send_cap[i] ? num_send[i] : e->send_cap[i];
+
+        memset(&e->send_blocks[send_total], 0, sizeof(Boid));
+        e->send_blocks[send_total].id = num_send[i];
+        memcpy(&e->send_blocks[send_total + 1], &send[displs[i]], inline_count * sizeof(Boid));
+
+        if (num_send[i] > inline_count) {
+            MPI_Isend(&send[displs[i] + inline_count], (num_send[i] - inline_count) * sizeof(Boid),
+                      MPI_BYTE, e->ranks[i], e->tag, e->comm, &e->overflow_r[e->num_overflow++]);
+        }
+
+        send_total += e->send_cap[i] + 1;
+        e->send_cap[i] = NextCapacity(e->send_cap[i], num_send[i]);
+    }
+
+    MPI_Ineighbor_alltoallv(e->send_blocks, send_counts, send_displs, MPI_BYTE,
+                            e->recv_blocks, recv_counts, recv_displs, MPI_BYTE, e->comm, &e->r);
+}
+
+/*
+ * Waits for the blocks, and reads the number each neighbor sent out of them into
+ * e->num_recv
+ */
+int
+ExchangeWait(Exchange* e)
+{
+    int i, offset = 0, total = 0;
+
+    MPI_Wait(&e->r, MPI_STATUS_IGNORE);
+
+    for (i = 0; i < e->n; ++i) {
+        e->num_recv[i] = e->recv_blocks[offset].id;
+        total += e->num_recv[i];
+        offset += e->recv_cap[i] + 1;
+    }
+
+    return total;
+}
+
+/*
+ * Gathers the boids from each block, plus any overflow, into recv. The overflow is
+ * received straight into place, so nothing is copied twice
+ */
+void
+ExchangeUnpack(Exchange* e, Boid* recv)
+{
+    int i, inline_count, offset = 0, idx = 0;
+
+    for (i = 0; i < e->n; ++i) {
+        inline_count = e->num_recv[i] < e->recv_cap[i] ? e->num_recv[i] : e->recv_cap[i];
+        memcpy(&recv[idx], &e->recv_blocks[offset + 1], inline_count * sizeof(Boid));
+        idx += inline_count;
+
+        if (e->num_recv[i] > inline_count) {
+            MPI_Recv(&recv[idx], (e->num_recv[i] - inline_count) * sizeof(Boid), MPI_BYTE,
+                     e->ranks[i], e->tag, e->comm, MPI_STATUS_IGNORE);
+            idx += e->num_recv[i] - inline_count;
+        }
+
+        offset += e->recv_cap[i] + 1;
+        e->recv_cap[i] = NextCapacity(e->recv_cap[i], e->num_recv[i]);
+    }
+
+    MPI_Waitall(e->num_overflow, e->overflow_r, MPI_STATUSES_IGNORE);
+}
+
+/*
+ * Gathers everything received into e->recv, grouped by neighbor. The number received
+ * from each neighbor is left in e->num_recv, and the total in *total
+ */
+Boid*
+ExchangeFinish(Exchange* e, int* total)
+{
+    Boid* recv;
+
+    *total = ExchangeWait(e);
+    recv = (Boid*) BufferReserve(&e->recv, *total * sizeof(Boid));
+    ExchangeUnpack(e, recv);
+
+    return recv;
+}
+
+void
+ExchangeGrow(Exchange* e)
+{
+    if (e->send_size > 0 && GROW_HEADROOM * e->send_peak > e->send_size)
+        e->send_blocks = ResizeBlocks(e->send_blocks, &e->send_size,
+                                      GROW_HEADROOM * e->send_peak);
+    if (e->recv_size > 0 && GROW_HEADROOM * e->recv_peak > e->recv_size)
+        e->recv_blocks = ResizeBlocks(e->recv_blocks, &e->recv_size,
+                                      GROW_HEADROOM * e->recv_peak);
+    BufferGrow(&e->recv);
+}
+
+void
+ExchangeReserve(Exchange* e, int send_slots, int recv_slots)
+{
+    e->send_blocks = ReserveBlocks(e->send_blocks, &e->send_size, &e->send_peak, send_slots);
+    e->recv_blocks = ReserveBlocks(e->recv_blocks, &e->recv_size, &e->recv_peak, recv_slots);
+}
+
+/* Releases everything ExchangeInit and ExchangeStart allocated */
+void
+ExchangeFree(Exchange* e)
+{
+    free(e->send_cap);
+    free(e->recv_cap);
+    free(e->num_recv);
+    free(e->bytes);
+    free(e->overflow_r);
+    free(e->send_blocks);
+    free(e->recv_blocks);
+    BufferFree(&e->recv);
+    e->send_blocks = NULL;
+    e->recv_blocks = NULL;
+    e->send_size = 0;
+    e->recv_size = 0;
+    e->send_peak = 0;
+    e->recv_peak = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef _EXCHANGE_H_
+#define _EXCHANGE_H_
+
+#include "boid.h"
+#include "arena.h"
+#include <mpi.h>
+
+/* One kind of boid traffic between neighbor ranks (halo or migration), done in a
+   single round. Each neighbor gets a fixed size block holding a count followed by up
+   to capacity boids, so nobody has to be told how much to expect beforehand. Boids
+   that don't fit go in a separate message. Both ends of a pair adjust the capacity
+   the same way from the counts they saw, so they always agree on block sizes */
+typedef struct exchange_s {
+    MPI_Comm comm;
+    int tag;
+    int n;
+    int* ranks;
+    int* send_cap;
+    int* recv_cap;
+    int* num_recv;
+    int* bytes;
+    Boid* send_blocks;
+    Boid* recv_blocks;
+    Buffer recv;
+    int send_size;
+    int recv_size;
+    int send_peak;
+    int recv_peak;
+    MPI_Request r;
+    MPI_Request* overflow_r;
+    int num_overflow;
+} Exchange;
+
+/* Sets up an exchange over a graph communicator with n neighbors */
+void ExchangeInit(Exchange*, MPI_Comm, int*, int, int, int);
+
+/* Packs and posts the exchange. num_send[i] boids starting at send[displs[i]] go to
+   neighbor i. send has to stay untouched until ExchangeFinish returns */
+void ExchangeStart(Exchange*, Boid*, int*, int*);
+
+/* Waits for the exchange, and returns how many boids arrived. How many came from
+   each neighbor is left in num_recv */
+int ExchangeWait(Exchange*);
+
+/* After ExchangeWait, copies the boids that arrived into an array with room for
+   them, grouped by neighbor */
+void ExchangeUnpack(Exchange*, Boid*);
+
+/* Waits for the exchange, and returns everything received as one array. The array
+   belongs to the exchange, and is reused by the next ExchangeFinish */
+Boid* ExchangeFinish(Exchange*, int*);
+
+/* Grows the exchange's buffers to GROW_HEADROOM times the most any exchange so far
+   has needed. Only between exchanges */
+void ExchangeGrow(Exchange*);
+
+/* Makes room for blocks of at least this many send and receive slots in all. Only
+   between exchanges */
+void ExchangeReserve(Exchange*, int, int);
+
+/* Frees the exchange buffers */
+void ExchangeFree(Exchange*);
+
+#endif
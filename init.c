@@ -1,5 +1,5 @@
-#include "clcg4.h"
 #include "init.h"
+#include "rng.h"
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -13,64 +13,123 @@
  * quadrant they were initialized in
  */
 void
-Initialize(Boid** boids, Config* c, int* mynumboids, int myrank, int numranks)
+Initialize(Boid** boids, Config* c, int* mynumboids, int myrank, int numranks, MPI_Comm comm)
 {
-    CheckRanks(myrank, numranks);
+    int dims[2];
+    RankDims(numranks, c->sidelen_x, c->sidelen_y, dims);
+    CheckRanks(myrank, dims, c);
 
-    if (myrank == 0)
-        InitializeRanks(boids, mynumboids, numranks, c->numboids, c->sidelen);
+    /* The simulator draws from the same seed later, so it is settled here once */
+    c->seed = RngResolveSeed(c->seed, myrank, comm);
+
+    if (c->parallel_init)
+        InitializeLocal(boids, mynumboids, c, dims, myrank, numranks, comm);
+
+    else if (myrank == 0)
+        InitializeRanks(boids, mynumboids, numranks, dims, c, comm);
 
     else {
-        MPI_Recv(mynumboids, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        MPI_Recv(mynumboids, 1, MPI_INT, 0, 0, comm, MPI_STATUS_IGNORE);
 
         *boids = (Boid*) calloc( (*mynumboids), sizeof(Boid) );
-        MPI_Recv(*boids, (*mynumboids) * sizeof(Boid), MPI_BYTE, 0, 1, MPI_COMM_WORLD,
+        MPI_Recv(*boids, (*mynumboids) * sizeof(Boid), MPI_BYTE, 0, 1, comm,
                  MPI_STATUS_IGNORE);
     }
 }
 
+/*
+ * Generates this rank's share of the boids directly inside its box, so no rank ever
+ * holds more than its own boids and startup time doesn't grow with numranks. Boxes
+ * start out equal, so each rank takes numboids / numranks, with the remainder spread
+ * over the lowest ranks. Ids come from an MPI_Exscan of those counts, so they are
+ * 0 .. numboids - 1 with no gaps, as before. Random numbers are keyed by id, so
+ * ranks never share a stream
+ */
+void
+InitializeLocal(Boid** boids, int* mynumboids, Config* c, int* dims, int myrank, int numranks,
+                MPI_Comm comm)
+{
+    int i, first_id = 0;
+    double u[2], a[2];
+    double x_width = c->sidelen_x / dims[0];
+    double y_width = c->sidelen_y / dims[1];
+    double x0 = (myrank % dims[0]) * x_width;
+    double y0 = (myrank / dims[0]) * y_width;
+
+    *mynumboids = c->numboids / numranks + (myrank < c->numboids % numranks ? 1 : 0);
+    MPI_Exscan(mynumboids, &first_id, 1, MPI_INT, MPI_SUM, comm);
+    if (myrank == 0)
+        first_id = 0;
+
+    *boids = (Boid*) malloc( (*mynumboids) * sizeof(Boid) );
+    for (i = 0; i < *mynumboids; ++i) {
+        (*boids)[i].id = first_id + i;
+        RngUniform2(c->seed, first_id + i, 0, RNG_POSITION, u);
+        RngUniform2(c->seed, first_id + i, 0, RNG_HEADING, a);
+        (*boids)[i].r.x = x0 + u[0] * x_width;
+        (*boids)[i].r.y = y0 + u[1] * y_width;
+        (*boids)[i].v.x = c->v * cos(a[0] * 2 * M_PI);
+        (*boids)[i].v.y = c->v * sin(a[0] * 2 * M_PI);
+    }
+}
+
 /*
  * Initialize all positions and velocities of boids, and sends them to various ranks,
- * except for those owned by rank 0
+ * except for those owned by rank 0. Boid j gets id j, and its position and heading
+ * only depend on the seed and j, so the layout is the same for any number of ranks
+ *
+ * Boids are put in rank order with a counting sort, so every boid is set up once
+ * and each rank's boids go out from one place. Going through the ids in order keeps
+ * each rank's boids sorted by id
  */
 void
-InitializeRanks(Boid** myboids, int* mynumboids, int numranks, int numboids, double sidelen)
+InitializeRanks(Boid** myboids, int* mynumboids, int numranks, int* dims, Config* c,
+                MPI_Comm comm)
 {
-    Vec* boid_positions = InitBoidPositions(numranks, numboids, sidelen);
-    int* boid_ranks = BoidRanks(boid_positions, numranks, numboids, sidelen);
-    int* boids_per_rank = DistributeBoids(boid_positions, numboids, numranks, sidelen);
-
-    Boid* boids = NULL;
-    int rank, j, idx;
-    unsigned int boid_counter = 0;
-    /* Send boids to all nonzero ranks */
-    for (rank = 1; rank < numranks; ++rank) {
-        boids = (Boid*) malloc( boids_per_rank[rank] * sizeof(Boid) );
+    int numboids = c->numboids;
+    Vec* boid_positions = InitBoidPositions(numboids, c->seed, c->sidelen_x, c->sidelen_y);
+    int* boid_ranks = BoidRanks(boid_positions, dims, numboids, c->sidelen_x, c->sidelen_y);
+    int* boids_per_rank = DistributeBoids(boid_ranks, numboids, numranks);
+    int* next = (int*) malloc( numranks * sizeof(int) );
+    Boid* boids = (Boid*) malloc( numboids * sizeof(Boid) );
+    int rank, j, first, sum = 0;
 
-        /* Send number of boids this rank will be receiving */
-        MPI_Send(&boids_per_rank[rank], 1, MPI_INT, rank, 0, MPI_COMM_WORLD);
-        idx = 0;
-        for (j = 0; j < numboids; ++j) {
-            if ( boid_ranks[j] == rank ) {
-                boids[idx].id = boid_counter++;
-                boids[idx].r = boid_positions[j];
-                VecRandomAngle(&(boids[idx++].v), 0.03);
-            }
-        }
-        MPI_Send(boids, boids_per_rank[rank] * sizeof(Boid), MPI_BYTE, rank, 1, MPI_COMM_WORLD);
+    for (rank = 0; rank < numranks; ++rank) {
+        next[rank] = sum;
+        sum += boids_per_rank[rank];
     }
+    for (j = 0; j < numboids; ++j)
+        InitBoid(&boids[next[boid_ranks[j]]++], j, boid_positions[j], c);
 
-    /* Handle rank 0 */
-    idx = 0;
-    *myboids = (Boid*) malloc( boids_per_rank[0] * sizeof(Boid) );
-    for (j = 0; j < numboids; ++j) {
-        if (boid_ranks[j] == 0) {
-            (*myboids)[idx].id = boid_counter++;
-            (*myboids)[idx].r = boid_positions[j];
-            VecRandomAngle( &((*myboids)[idx++].v), 0.03 );
-        }
+    /* Send boids to all nonzero ranks. next[rank] is now where rank's boids end */
+    for (rank = 1; rank < numranks; ++rank) {
+        /* Send number of boids this rank will be receiving */
+        MPI_Send(&boids_per_rank[rank], 1, MPI_INT, rank, 0, comm);
+        first = next[rank] - boids_per_rank[rank];
+        MPI_Send(boids + first, boids_per_rank[rank] * sizeof(Boid), MPI_BYTE, rank, 1, comm);
     }
+
+    /* Handle rank 0, whose boids come first */
     *mynumboids = boids_per_rank[0];
+    *myboids = (Boid*) realloc( boids, (*mynumboids > 0 ? *mynumboids : 1) * sizeof(Boid) );
+
+    free(next);
+    free(boids_per_rank);
+    free(boid_ranks);
+    free(boid_positions);
+}
+
+/* Fills in boid id at position r, heading in a random direction at speed v */
+void
+InitBoid(Boid* b, unsigned int id, Vec r, Config* c)
+{
+    double a[2];
+    RngUniform2(c->seed, id, 0, RNG_HEADING, a);
+
+    b->id = id;
+    b->r = r;
+    b->v.x = c->v * cos(a[0] * 2 * M_PI);
+    b->v.y = c->v * sin(a[0] * 2 * M_PI);
 }
 
 /*
@@ -78,48 +137,69 @@ InitializeRanks(Boid** myboids, int* mynumboids, int numranks, int numboids, dou
  * value is the rank the ith boid is going to be
  */
 int*
-BoidRanks(Vec* boid_positions, int numranks, int numboids, double sidelen)
+BoidRanks(Vec* boid_positions, int* dims, int numboids, double sidelen_x, double sidelen_y)
 {
     int i;
     int* boid_ranks = (int*) malloc( numboids * sizeof(int) );
     for (i = 0; i < numboids; ++i)
-        boid_ranks[i] = VecToRank(boid_positions[i], sidelen, numranks);
+        boid_ranks[i] = VecToRank(boid_positions[i], sidelen_x, sidelen_y, dims);
     return boid_ranks;
 }
 
 /*
- * Based off location specified in Vec v, as well as the length along the total
- * side of the simulation and the number of ranks, this function returns the
- * rank where the boid belongs
+ * Based off location specified in Vec v, as well as the lengths of the sides of
+ * the simulation and the dims[0] x dims[1] grid of ranks, this function returns
+ * the rank where the boid belongs. Ranks are numbered along x first
  */
 int
-VecToRank(Vec v, double sidelen, int numranks)
+VecToRank(Vec v, double sidelen_x, double sidelen_y, int* dims)
 {
-    double x_width = sidelen / sqrt((double) numranks);
-    double y_width = sidelen / sqrt((double) numranks);
+    double x_width = sidelen_x / dims[0];
+    double y_width = sidelen_y / dims[1];
 
     int x_quad = (int) floor(v.x / x_width);
     int y_quad = (int) floor(v.y / y_width);
 
-    int ranks_per_side = (int) sqrt(numranks);
+    /* A boid sitting exactly on the far edge belongs to the last rank */
+    if (x_quad >= dims[0]) x_quad = dims[0] - 1;
+    if (y_quad >= dims[1]) y_quad = dims[1] - 1;
+    if (x_quad < 0) x_quad = 0;
+    if (y_quad < 0) y_quad = 0;
 
-    return x_quad + y_quad * ranks_per_side;
+    return x_quad + y_quad * dims[0];
 }
 
 /*
- * This information is necessary so each rank knows how many boids it's
- * supposed to receive for MPI_recv.
- *
- * Information about which position goes where could be saved for later so it
- * doesn't have to be recalculated, but that would add complications to what
- * is a quick O(N) calculation, so it's not saved
+ * Splits numranks into a dims[0] x dims[1] grid with MPI_Dims_create, which makes it
+ * as square as possible. The longer side of the box gets the larger count, so the
+ * ranks' boxes stay close to square and halos stay small
+ */
+void
+RankDims(int numranks, double sidelen_x, double sidelen_y, int* dims)
+{
+    int tmp;
+    dims[0] = 0;
+    dims[1] = 0;
+    MPI_Dims_create(numranks, 2, dims);
+
+    /* MPI_Dims_create returns the dimensions largest first */
+    if (sidelen_y > sidelen_x) {
+        tmp = dims[0];
+        dims[0] = dims[1];
+        dims[1] = tmp;
+    }
+}
+
+/*
+ * Counts the boids going to each rank, from the ranks BoidRanks picked. This
+ * information is necessary so each rank knows how many boids it's supposed to
+ * receive for MPI_recv
  */
 int*
-DistributeBoids(Vec* boid_positions, int numboids, int numranks, double sidelen)
+DistributeBoids(int* boid_ranks, int numboids, int numranks)
 {
     /* Calloc initilizes all values to 0 */
     int* boids_per_rank = (int*) calloc( numranks, sizeof(int) );
-    int* boid_ranks = BoidRanks(boid_positions, numranks, numboids, sidelen);
 
     int i;
     for (i = 0; i < numboids; ++i)
@@ -134,33 +214,44 @@ DistributeBoids(Vec* boid_positions, int numboids, int numranks, double sidelen)
  * its own Simulator object, this is done early in the main function instead
  */
 Vec*
-InitBoidPositions(int numranks, int numboids, double sidelen)
+InitBoidPositions(int numboids, int seed, double sidelen_x, double sidelen_y)
 {
     Vec* boid_positions = (Vec*) malloc( numboids * sizeof(Vec) );
+    double u[2];
 
-    srand( time(NULL) );
-    int seed = rand() % Maxgen;  /* Maximum seed value specified in clcg4.h */
-
-    seed = 1;
     int i;
     for (i = 0; i < numboids; ++i) {
-        boid_positions[i].x = GenVal(seed) * sidelen;
-        boid_positions[i].y = GenVal(seed) * sidelen;
+        RngUniform2(seed, i, 0, RNG_POSITION, u);
+        boid_positions[i].x = u[0] * sidelen_x;
+        boid_positions[i].y = u[1] * sidelen_y;
     }
     return boid_positions;
 }
 
 /*
- * Checks that numranks is a power of 4, as is assumed by the program. Prints
- * out error if rank 0
+ * Any number of ranks works, but each rank's box has to be at least cutoff wide, since
+ * the load balancer keeps them that wide and can only do so if they start out that way.
+ * Halo boids come from every rank whose box is within cutoff. Verlet lists reach out to
+ * cutoff + verlet_skin, and look across the periodic edges, so then boxes have to be
+ * that wide, and the whole box twice that so no boid is within reach of two copies of
+ * another. Prints out error if rank 0
  */
 void
-CheckRanks(int myrank, int numranks)
+CheckRanks(int myrank, int* dims, Config* c)
 {
-    double splitlvl = log( (double)numranks ) / log(4);
-    if (floor(splitlvl) != splitlvl) {
+    double reach = c->cutoff + (c->verlet_skin > 0.0 ? c->verlet_skin : 0.0);
+
+    if (c->sidelen_x / dims[0] < reach || c->sidelen_y / dims[1] < reach) {
+        if (myrank == 0)
+            fprintf(stderr, "A %i x %i grid of ranks leaves boxes narrower than cutoff%s\n",
+                    dims[0], dims[1], reach > c->cutoff ? " + verlet_skin" : "");
+        exit(1);
+    }
+
+    if (reach > c->cutoff && (c->sidelen_x < 2 * reach || c->sidelen_y < 2 * reach)) {
         if (myrank == 0)
-            fprintf(stderr, "Number of ranks needs to be a power of 4\n");
+            fprintf(stderr, "Verlet lists need the box to be at least twice cutoff + "
+                    "verlet_skin across\n");
         exit(1);
     }
 }
@@ -4,26 +4,36 @@
 #include "vec.h"
 #include "boid.h"
 #include "io.h"
+#include <mpi.h>
 
-/* Makes sure the number of MPI ranks is valid */
-void CheckRanks(int, int);
+/* Makes sure the ranks' boxes are big enough for the cutoff */
+void CheckRanks(int, int*, Config*);
+
+/* Picks how many ranks go along x and along y */
+void RankDims(int, double, double, int*);
 
 /* Finds the rank a given position is supposed to be at */
-int VecToRank(Vec, double, int);
+int VecToRank(Vec, double, double, int*);
 
 /* Create array where boid i goes to rank[i] */
-int* BoidRanks(Vec*, int, int, double);
+int* BoidRanks(Vec*, int*, int, double, double);
 
 /* Intialize positions of all boids in simulation */
-Vec* InitBoidPositions(int, int, double);
+Vec* InitBoidPositions(int, int, double, double);
+
+/* Sets up one boid with a random heading */
+void InitBoid(Boid*, unsigned int, Vec, Config*);
 
-/* Break up boids before sending to ranks */
-int* DistributeBoids(Vec*, int, int, double);
+/* Counts how many boids go to each rank */
+int* DistributeBoids(int*, int, int);
 
 /* Initialize boids if rank 0, receive boids otherwise */
-void Initialize(Boid**, Config*, int*, int, int);
+void Initialize(Boid**, Config*, int*, int, int, MPI_Comm);
+
+/* Each rank generates the boids in its own box */
+void InitializeLocal(Boid**, int*, Config*, int*, int, int, MPI_Comm);
 
 /* Initialize velocities and actually send boids to necessary ranks */
-void InitializeRanks(Boid**, int*, int, int, double);
+void InitializeRanks(Boid**, int*, int, int*, Config*, MPI_Comm);
 
 #endif
@@ -1,36 +1,170 @@
 #include "io.h"
 #include "ini.h"
+#include "arena.h"
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <math.h>
 #include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_thread_num() 0
+#define omp_get_num_threads() 1
+#define omp_get_max_threads() 1
+#endif
 
 /* Define macro specified in ini example. See github */
 #define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
 
+/* Where the next timestep starts in the text output file */
+static MPI_Offset text_offset;
+
+/* Every rank's byte count for a tick, kept between ticks */
+static Buffer rank_bytes;
+
+/* MPI counts are ints, so a rank's text goes out as whole chunks of TEXT_CHUNK bytes,
+   then whatever is left over */
+#define TEXT_CHUNK (1 << 20)
+static MPI_Datatype chunk_type = MPI_DATATYPE_NULL;
+
+/*
+ * Finds where the header of tick starts in a text output file, reading it front to back
+ * in blocks. Headers after the first start with the newline that ends the previous tick,
+ * so that is what is searched for. If the tick isn't there, output just carries on at
+ * the end of the file
+ */
+static MPI_Offset
+FindTickOffset(char* fname, int numboids, int tick)
+{
+    char pattern[64];
+    char* block = (char*) malloc( (1 << 20) + 64 );
+    int len = sprintf(pattern, "\n%i\n# Time step = %i\n", numboids, tick);
+    int keep = 0, got, i;
+    MPI_Offset start = 0, found = -1;
+    FILE* f = fopen(fname, "rb");
+
+    while (f && found < 0 && (got = fread(block + keep, 1, 1 << 20, f)) > 0) {
+        got += keep;
+        for (i = 0; i + len <= got; ++i) {
+            if (block[i] == '\n' && memcmp(block + i, pattern, len) == 0) {
+                found = start + i;
+                break;
+            }
+        }
+
+        /* Keep the tail, in case the header straddles two blocks */
+        keep = got < len - 1 ? got : len - 1;
+        memmove(block, block + got - keep, keep);
+        start += got - keep;
+    }
+
+    /* Not finding it is normal when the run stopped right after the checkpoint */
+    if (found < 0)
+        found = f ? start + keep : 0;
+    if (!f)
+        fprintf(stderr, "%s not found, restarting output from tick %i\n", fname, tick);
+
+    if (f)
+        fclose(f);
+    free(block);
+    return found;
+}
+
 /*
- * Controller function for output. Uses a static variable (so that it stays persistent between
- * calls) to keep track of a global offset within the file, so that each timestep doesn't overwrite
- * another, and calculates a local offset based of how many bytes each rank is writing. Finds this
- * with an MPI_Allgather each call
+ * Drops any output from after tick, so the file reads as if the run had never stopped
+ * when restarting from a checkpoint. A new run starts at tick 0 and empties the file, so
+ * output from an earlier, longer run doesn't linger at the end of it
  */
 void
-WriteRankData(char* fname, Boid* boids, int mynumboids, int global_numboids, int ticknum,
-              int myrank, int numranks)
+ResumeTextOutput(char* fname, int numboids, int tick, MPI_Comm comm)
 {
+    int myrank;
+    MPI_File fh;
+
+    MPI_Comm_rank(comm, &myrank);
+    if (myrank == 0)
+        text_offset = tick > 0 ? FindTickOffset(fname, numboids, tick) : 0;
+    MPI_Bcast(&text_offset, 1, MPI_OFFSET, 0, comm);
+
+    MPI_File_open(comm, fname, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    MPI_File_set_size(fh, text_offset);
+    MPI_File_close(&fh);
+}
+
+/*
+ * Starts a CSV that gets a line or more per recorded tick. A restarted run drops the lines
+ * from first_tick on, which it is about to write again. Only called on one rank, and
+ * returns NULL with a message if the file can't be written
+ */
+FILE*
+OpenTickLog(char* fname, char* header, int first_tick)
+{
+    long size = 0;
+    char* text = NULL;
+    char* line;
+    char* next;
+    FILE* f = first_tick > 0 ? fopen(fname, "rb") : NULL;
+
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        text = (char*) malloc( size + 1 );
+        size = fread(text, 1, size, f);
+        text[size] = '\0';
+        fclose(f);
+    }
 
-    static int global_offset;
-    int num_bytes, i;
-    int total_bytes = 0;
-    int local_offset = 0;
+    f = fopen(fname, "w");
+    if (!f) {
+        fprintf(stderr, "Could not open %s, it won't be written\n", fname);
+        free(text);
+        return NULL;
+    }
+
+    fputs(header, f);
+    for (line = text; line && *line; line = next) {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : line + strlen(line);
+        if (line[0] >= '0' && line[0] <= '9' && atoi(line) < first_tick)
+            fwrite(line, 1, next - line, f);
+    }
+
+    free(text);
+    return f;
+}
+
+/*
+ * Controller function for output. Keeps track of a global offset within the file in
+ * text_offset, so that each timestep doesn't overwrite another, and calculates a local offset
+ * based of how many bytes each rank is writing. Finds this with an MPI_Allgather over comm
+ * each call. Byte counts and offsets are 64 bit, since a tick of a big run is more than
+ * 2 GB of text
+ */
+void
+WriteRankData(char* fname, Boid* boids, int mynumboids, int global_numboids, int ticknum,
+              int myrank, int numranks, MPI_Comm comm)
+{
+    int i;
+    long long num_bytes;
+    MPI_Offset total_bytes = 0;
+    MPI_Offset local_offset = 0;
+    MPI_Offset chunks;
     MPI_File fh;
 
     char* io_line = GenerateRankData(boids, myrank, mynumboids, global_numboids, ticknum,
                                      &num_bytes);
-    int* bytes_per_rank = (int*) calloc(numranks, sizeof(int));
+    long long* bytes_per_rank = (long long*) BufferReserve(&rank_bytes,
+                                                           numranks * sizeof(long long));
+
+    if (chunk_type == MPI_DATATYPE_NULL) {
+        MPI_Type_contiguous(TEXT_CHUNK, MPI_CHAR, &chunk_type);
+        MPI_Type_commit(&chunk_type);
+    }
 
-    MPI_Allgather(&num_bytes, 1, MPI_INT, bytes_per_rank, 1, MPI_INT, MPI_COMM_WORLD);
+    MPI_Allgather(&num_bytes, 1, MPI_LONG_LONG, bytes_per_rank, 1, MPI_LONG_LONG, comm);
 
     for (i = 0; i < numranks; ++i) {
         total_bytes += bytes_per_rank[i];
@@ -38,87 +172,213 @@ WriteRankData(char* fname, Boid* boids, int mynumboids, int global_numboids, int
             local_offset += bytes_per_rank[i];
     }
 
-    MPI_File_open(MPI_COMM_WORLD, fname, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
-    MPI_File_write_at(fh, global_offset + local_offset, io_line, num_bytes, MPI_CHAR,
-                      MPI_STATUS_IGNORE);
+    MPI_File_open(comm, fname, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    chunks = num_bytes / TEXT_CHUNK;
+    if (chunks > 0)
+        MPI_File_write_at(fh, text_offset + local_offset, io_line, (int) chunks, chunk_type,
+                          MPI_STATUS_IGNORE);
+    MPI_File_write_at(fh, text_offset + local_offset + chunks * TEXT_CHUNK,
+                      io_line + chunks * TEXT_CHUNK, (int) (num_bytes - chunks * TEXT_CHUNK),
+                      MPI_CHAR, MPI_STATUS_IGNORE);
     MPI_File_close(&fh);
 
-    global_offset += total_bytes;
+    text_offset += total_bytes;
+}
+
+/*
+ * The text output, one span per thread. Thread 0's span is the output buffer itself, and
+ * the others are copied onto its end. Kept between ticks and only ever grown, so writing
+ * a tick doesn't allocate anything once the boid count settles
+ */
+static Buffer* spans;
+static int num_spans;
+static Buffer span_lengths;
 
-    free(bytes_per_rank);
-    free(io_line);
+/*
+ * Writes v into out exactly as printf's %i would, and returns the number of characters.
+ * Digits are produced backwards into a scratch array, then copied over
+ */
+int
+FormatInt(char* out, int v)
+{
+    char digits[12];
+    int n = 0, len = 0;
+    unsigned int u = v < 0 ? -(unsigned int) v : (unsigned int) v;
+
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u > 0);
+
+    if (v < 0)
+        out[len++] = '-';
+    while (n > 0)
+        out[len++] = digits[--n];
+
+    return len;
 }
 
 /*
- * Generates output line for each boid in simulation. Uses sprintf to write strings to a large
- * buffer array in the stack. Keeps track of the number of bytes written usen return values from
- * sprintf. Rank 0 also writes the 'headers' for each timestep, along with controlling the newlines
- * between each timestep so everything looks nice
+ * Writes v into out exactly as printf's %f would, and returns the number of characters.
+ *
+ * printf rounds the exact binary value of v to 6 decimals, with ties going to even. v
+ * times 10^6 isn't exact in a double, but fma gives the rounding error of that product
+ * exactly, which settles which way the exact value rounds whenever the product lands on
+ * a half. True ties only happen when v is an odd multiple of 1/128, and then the error
+ * is 0 and nearbyint's own ties to even rule applies. Values too big for
+ * the scaled value to fit in 53 bits, infinities and NaNs are left to snprintf
  */
-char*
-GenerateRankData(Boid* boids, int myrank, int mynumboids, int global_numboids, int ticknum,
-                 int* num_bytes)
+int
+FormatFixed(char* out, double v)
 {
-    Boid b;
-    char buff[1024];
-    int i, n_temp;
-    int n = 0;
-    int offset = 0;
-    char** io_lines = NULL;
-
-    /* Make sure headers and newlines are done appropriatiately. Different size callocs are needed
-       depending on  whether or not headers are included or not*/
-    if (myrank == 0) {
-        io_lines = (char**) calloc(mynumboids + 1, sizeof(char*));
+    double a = fabs(v), p, err, n;
+    unsigned long long u, ipart;
+    unsigned int frac;
+    int i, len = 0;
+
+    if (!(a < 9.0e9))
+        return snprintf(out, 512, "%f", v);
+
+    p = a * 1e6;
+    err = fma(a, 1e6, -p);
+    n = nearbyint(p);
+    if (p - n == 0.5 && err > 0.0)
+        n += 1.0;
+    else if (p - n == -0.5 && err < 0.0)
+        n -= 1.0;
+
+    u = (unsigned long long) n;
+    ipart = u / 1000000;
+    frac = (unsigned int) (u % 1000000);
 
-        if (ticknum > 0)
-            n += sprintf(buff, "\n%i\n# Time step = %i\n", global_numboids, ticknum);
-        else
-            n += sprintf(buff, "%i\n# Time step = %i\n", global_numboids, ticknum);
+    /* printf keeps the sign of negative values that round to 0, and of -0.0 */
+    if (signbit(v))
+        out[len++] = '-';
 
-        io_lines[0] = strdup(buff);
-        offset = 1;
+    if (ipart == 0) {
+        out[len++] = '0';
     }
     else {
-        io_lines = (char**) calloc(mynumboids, sizeof(char*));
+        char digits[20];
+        int nd = 0;
+        while (ipart > 0) {
+            digits[nd++] = '0' + ipart % 10;
+            ipart /= 10;
+        }
+        while (nd > 0)
+            out[len++] = digits[--nd];
+    }
+
+    out[len++] = '.';
+    for (i = 5; i >= 0; --i) {
+        out[len + i] = '0' + frac % 10;
+        frac /= 10;
     }
 
+    return len + 6;
+}
+
+/*
+ * Formats n boids into span after the first used bytes already in it, and returns how
+ * many bytes it holds then. A line with values below 9e9 is at most 89 characters, but
+ * the snprintf fallback in FormatFixed can take up to 512 per value, so room is checked
+ * as we go
+ */
+static long long
+FormatBoids(Buffer* span, long long used, Boid* boids, int n)
+{
+    Boid b;
+    char* out;
+    int i;
+
+    BufferReserve(span, used + (long long) n * 96 + 64);
+
     /* CHANGE ME FLAG
        If you need to change the format of each output line (include/exclude velocity info) change
-       the sprintf line to your needs */
-    for (i = 0; i < mynumboids; ++i) {
+       the lines below, which write "%i %f %f 0.0 %f %f 0.0\n" */
+    for (i = 0; i < n; ++i) {
+        if (used + 4 * 512 + 64 > (long long) span->size)
+            BufferReserve(span, used + 4 * 512 + 64);
+
         b = boids[i];
-        n += sprintf(buff, "%i %f %f 0.0 %f %f 0.0\n", b.id, b.r.x, b.r.y, b.v.x, b.v.y);
-        io_lines[i + offset] = strdup(buff);
+        out = (char*) span->data + used;
+        out += FormatInt(out, b.id);
+        *out++ = ' ';
+        out += FormatFixed(out, b.r.x);
+        *out++ = ' ';
+        out += FormatFixed(out, b.r.y);
+        memcpy(out, " 0.0 ", 5);
+        out += 5;
+        out += FormatFixed(out, b.v.x);
+        *out++ = ' ';
+        out += FormatFixed(out, b.v.y);
+        memcpy(out, " 0.0\n", 5);
+        out += 5;
+        used = out - (char*) span->data;
     }
-    *num_bytes = n;
 
-    /* This function actually generates an array of strings. Calls ConcatenateOutput so that the
-       function can return 1 single coherent string per rank */
-    return ConcatenateOutput(io_lines, mynumboids + offset, n);
+    return used;
 }
 
 /*
- * As stated above, this function returns a single string from an array of strings for easy writing
- * Handles null char manually by writing one to the end of the line. Does not include null chars
- * from any of the strings in the original array
+ * Generates output line for each boid in simulation into the reusable output buffer.
+ * Lines are byte for byte what sprintf would give for the format in FormatBoids. Rank 0
+ * also writes the 'headers' for each timestep, along with controlling the newlines
+ * between each timestep so everything looks nice. The returned buffer belongs to this
+ * file, so callers must not free it, and it is overwritten on the next call.
+ *
+ * Each thread formats an even share of the boids into its own span, thread 0 straight
+ * after the header. Once every length is known, the other spans are copied onto the end
+ * of thread 0's in order, in parallel
  */
-char* ConcatenateOutput(char** io_lines, int mynumboids, int num_chars)
+char*
+GenerateRankData(Boid* boids, int myrank, int mynumboids, int global_numboids, int ticknum,
+                 long long* num_bytes)
 {
-    char* io_line = (char*) calloc(num_chars + 1, sizeof(char));
-
-    int i, j, len;
-    int k = 0;
-    for (i = 0; i < mynumboids; ++i) {
-        len = strlen(io_lines[i]);
-        for (j = 0; j < len; ++j) {
-            io_line[k++] = io_lines[i][j];
+    int t, nt, threads = omp_get_max_threads();
+    long long lo, hi, header = 0;
+    long long* lengths;
+    long long* starts;
+
+    if (threads > num_spans) {
+        spans = (Buffer*) CountedRealloc(spans, threads * sizeof(Buffer));
+        memset(spans + num_spans, 0, (threads - num_spans) * sizeof(Buffer));
+        num_spans = threads;
+    }
+    lengths = (long long*) BufferReserve(&span_lengths, (2 * threads + 1) * sizeof(long long));
+    starts = lengths + threads;
+
+    /* Make sure headers and newlines are done appropriatiately */
+    if (myrank == 0) {
+        BufferReserve(&spans[0], 64);
+        header = sprintf((char*) spans[0].data, ticknum > 0 ? "\n%i\n# Time step = %i\n" :
+                         "%i\n# Time step = %i\n", global_numboids, ticknum);
+    }
+
+    #pragma omp parallel private(t, nt, lo, hi)
+    {
+        t = omp_get_thread_num();
+        nt = omp_get_num_threads();
+        lo = (long long) mynumboids * t / nt;
+        hi = (long long) mynumboids * (t + 1) / nt;
+        lengths[t] = FormatBoids(&spans[t], t == 0 ? header : 0, boids + lo, (int) (hi - lo));
+
+        #pragma omp barrier
+        #pragma omp single
+        {
+            starts[0] = 0;
+            for (t = 1; t <= nt; ++t)
+                starts[t] = starts[t - 1] + lengths[t - 1];
+            BufferReserve(&spans[0], starts[nt]);
+            *num_bytes = starts[nt];
         }
-        free(io_lines[i]);
+
+        t = omp_get_thread_num();
+        if (t > 0)
+            memcpy((char*) spans[0].data + starts[t], spans[t].data, lengths[t]);
     }
-    io_line[k] = 0x00;
-    free(io_lines);
-    return io_line;
+
+    return (char*) spans[0].data;
 }
 
 /*
@@ -140,6 +400,31 @@ DefaultConfig(void)
     c->noise = 1.0;
     c->cutoff = 1.0;
     c->sidelen = 5.0;
+    c->sidelen_x = -1.0;  // -1 means the same as sidelen
+    c->sidelen_y = -1.0;
+    c->cell_list = 1;  // 0 falls back to the brute force neighbor search
+    c->cutoff_halo = 1;  // 0 sends every neighbor the whole subdomain
+    c->soa = 1;  // 0 runs the neighbor search over Boid structs with BoidDist
+    c->exact_align = 0;  // 1 uses atan2/cos/sin instead of VecAlignBatch
+    c->overlap = 1;  // 0 waits for all halo boids before any velocity updates
+    c->verlet_skin = 0.0;  // 0 finds every boid's neighbors from scratch each tick
+    c->threads = 0;  // 0 leaves it to OMP_NUM_THREADS
+    c->timers = 1;  // 0 skips the per-phase timing report
+    c->check_level = 1;  // 0 no sanity checks, 2 checks every boid every tick
+    c->check_every = 10;
+    c->balance_every = 0;  // 0 never moves the rank boundaries
+    c->parallel_init = 0;  // 0 generates every boid on rank 0
+    c->binary_output = 0;  // 0 writes the text format
+    c->frames_per_write = 8;
+    c->io_ranks = 0;  // 0 has every rank write its own boids
+    c->analytics_every = 0;  // 0 skips analytics
+    c->analytics_file = "analytics.csv";
+    c->cluster_every = 0;  // 0 skips cluster detection
+    c->cluster_file = "clusters.csv";
+    c->checkpoint_every = 0;  // 0 only checkpoints when signalled
+    c->checkpoint_file = "checkpoint.bin";
+    c->restart = NULL;  // NULL starts a new run
+    c->start_tick = 0;  // Not read from the file, only set when restarting
 
     return c;
 }
@@ -154,6 +439,12 @@ Config* ReadConfig(char* fname)
         exit(1);
     }
 
+    /* A square box unless told otherwise */
+    if (c->sidelen_x <= 0.0)
+        c->sidelen_x = c->sidelen;
+    if (c->sidelen_y <= 0.0)
+        c->sidelen_y = c->sidelen;
+
     return c;
 }
 
@@ -183,9 +474,81 @@ int handler(void* user, const char* section, const char* name, const char* value
     else if (MATCH("", "sidelen")) {
         pconfig->sidelen = atof(value);
     }
+    else if (MATCH("", "sidelen_x")) {
+        pconfig->sidelen_x = atof(value);
+    }
+    else if (MATCH("", "sidelen_y")) {
+        pconfig->sidelen_y = atof(value);
+    }
     else if (MATCH("", "dt")) {
         pconfig->dt = atof(value);
     }
+    else if (MATCH("", "cell_list")) {
+        pconfig->cell_list = atoi(value);
+    }
+    else if (MATCH("", "cutoff_halo")) {
+        pconfig->cutoff_halo = atoi(value);
+    }
+    else if (MATCH("", "soa")) {
+        pconfig->soa = atoi(value);
+    }
+    else if (MATCH("", "exact_align")) {
+        pconfig->exact_align = atoi(value);
+    }
+    else if (MATCH("", "overlap")) {
+        pconfig->overlap = atoi(value);
+    }
+    else if (MATCH("", "verlet_skin")) {
+        pconfig->verlet_skin = atof(value);
+    }
+    else if (MATCH("", "threads")) {
+        pconfig->threads = atoi(value);
+    }
+    else if (MATCH("", "timers")) {
+        pconfig->timers = atoi(value);
+    }
+    else if (MATCH("", "check_level")) {
+        pconfig->check_level = atoi(value);
+    }
+    else if (MATCH("", "check_every")) {
+        pconfig->check_every = atoi(value);
+    }
+    else if (MATCH("", "balance_every")) {
+        pconfig->balance_every = atoi(value);
+    }
+    else if (MATCH("", "parallel_init")) {
+        pconfig->parallel_init = atoi(value);
+    }
+    else if (MATCH("", "binary_output")) {
+        pconfig->binary_output = atoi(value);
+    }
+    else if (MATCH("", "frames_per_write")) {
+        pconfig->frames_per_write = atoi(value);
+    }
+    else if (MATCH("", "io_ranks")) {
+        pconfig->io_ranks = atoi(value);
+    }
+    else if (MATCH("", "analytics_every")) {
+        pconfig->analytics_every = atoi(value);
+    }
+    else if (MATCH("", "analytics_file")) {
+        pconfig->analytics_file = strdup(value);
+    }
+    else if (MATCH("", "cluster_every")) {
+        pconfig->cluster_every = atoi(value);
+    }
+    else if (MATCH("", "cluster_file")) {
+        pconfig->cluster_file = strdup(value);
+    }
+    else if (MATCH("", "checkpoint_every")) {
+        pconfig->checkpoint_every = atoi(value);
+    }
+    else if (MATCH("", "checkpoint_file")) {
+        pconfig->checkpoint_file = strdup(value);
+    }
+    else if (MATCH("", "restart")) {
+        pconfig->restart = strdup(value);
+    }
     else if (MATCH("", "filename")) {
         pconfig->fname = strdup(value);
     }
@@ -2,6 +2,8 @@
 #define _IO_H_
 
 #include "boid.h"
+#include <stdio.h>
+#include <mpi.h>
 
 /* All input parameters of a simulation */
 typedef struct config_s {
@@ -14,6 +16,31 @@ typedef struct config_s {
     double noise;
     double cutoff;
     double sidelen;
+    double sidelen_x;
+    double sidelen_y;
+    int cell_list;
+    int cutoff_halo;
+    int soa;
+    int exact_align;
+    int overlap;
+    double verlet_skin;
+    int threads;
+    int timers;
+    int check_level;
+    int check_every;
+    int balance_every;
+    int parallel_init;
+    int binary_output;
+    int frames_per_write;
+    int io_ranks;
+    int analytics_every;
+    char* analytics_file;
+    int cluster_every;
+    char* cluster_file;
+    int checkpoint_every;
+    char* checkpoint_file;
+    char* restart;
+    int start_tick;
 } Config;
 
 /* Declare a default config */
@@ -22,14 +49,24 @@ Config* DefaultConfig(void);
 /* Reads in config */
 Config* ReadConfig(char*);
 
-/* Turn char** into char* */
-char* ConcatenateOutput(char**, int, int);
+/* Formats an int like printf's %i */
+int FormatInt(char*, int);
 
-/* Generate lines of output to be written */
-char* GenerateRankData(Boid*, int, int, int, int, int*);
+/* Formats a double like printf's %f */
+int FormatFixed(char*, double);
+
+/* Generate lines of output to be written, into a buffer reused every tick */
+char* GenerateRankData(Boid*, int, int, int, int, long long*);
+
+/* Cuts the text output back to where a tick starts, and continues writing from there */
+void ResumeTextOutput(char*, int, int, MPI_Comm);
+
+/* Opens a per-tick CSV log with a header line. When restarting, keeps the lines
+   for ticks before the given one */
+FILE* OpenTickLog(char*, char*, int);
 
 /* Write actual data */
-void WriteRankData(char*, Boid*, int, int, int, int, int);
+void WriteRankData(char*, Boid*, int, int, int, int, int, MPI_Comm);
 
 /* Handler function required bio ini library. See github for more info */
 int handler(void* user, const char* section, const char* name, const char* value);
@@ -0,0 +1,135 @@
+#include "ioserver.h"
+#include "traj.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compute side state. Two snapshot buffers, so the boids of one tick can be copied
+ * while the previous tick's send is still going
+ */
+static Boid* snapshot[2];
+static int snapshot_capacity[2];
+static MPI_Request snapshot_r[2];
+static int num_sent;
+
+/*
+ * Compute ranks are split into num_io contiguous groups, and group g is served by world
+ * rank num_compute + g, since the I/O ranks are the last ones
+ */
+int
+IoServerOf(int rank, int num_compute, int num_io)
+{
+    return num_compute + (int) ((long) rank * num_io / num_compute);
+}
+
+/*
+ * Copies the boids into whichever snapshot buffer is free, and starts sending it. The
+ * buffer was last used two ticks ago, so waiting on it almost never actually waits,
+ * unless the I/O ranks have fallen behind
+ */
+void
+IoSend(Boid* boids, int n, int server)
+{
+    int which = num_sent % 2;
+
+    if (num_sent >= 2)
+        MPI_Wait(&snapshot_r[which], MPI_STATUS_IGNORE);
+
+    if (n > snapshot_capacity[which]) {
+        free(snapshot[which]);
+        snapshot_capacity[which] = n + n / 2;
+        snapshot[which] = (Boid*) CountedMalloc( snapshot_capacity[which] * sizeof(Boid) );
+    }
+
+    memcpy(snapshot[which], boids, n * sizeof(Boid));
+    MPI_Isend(snapshot[which], n * sizeof(Boid), MPI_BYTE, server, IO_TAG, MPI_COMM_WORLD,
+              &snapshot_r[which]);
+    ++num_sent;
+}
+
+/*
+ * Waits for whichever sends are still outstanding, then frees the snapshots. A run can
+ * stop early to checkpoint, so the I/O rank isn't told how many ticks to expect, and
+ * instead gets an empty message with its own tag once there are no more
+ */
+void
+IoFinish(int server)
+{
+    int i;
+    for (i = 0; i < 2 && i < num_sent; ++i) {
+        MPI_Wait(&snapshot_r[i], MPI_STATUS_IGNORE);
+        free(snapshot[i]);
+        snapshot[i] = NULL;
+        snapshot_capacity[i] = 0;
+    }
+
+    MPI_Send(NULL, 0, MPI_BYTE, server, IO_STOP_TAG, MPI_COMM_WORLD);
+}
+
+/*
+ * Main loop of an I/O rank. Each tick it takes one snapshot from every compute rank it
+ * serves, in rank order, and writes them out as if it were one rank holding all those
+ * boids. io_comm holds just the I/O ranks, so the writers' collectives run among them.
+ * Messages from one compute rank arrive in tick order, so no tick number is sent along.
+ * Compute ranks all stop after the same tick, so every I/O rank sees its stop messages
+ * in place of the same tick's snapshots
+ */
+void
+IoServe(Config* c, MPI_Comm io_comm, int num_compute)
+{
+    int myrank, io_rank, num_io, client, tick, bytes, n, stop = 0;
+    int capacity = 0;
+    Boid* boids = NULL;
+    MPI_Status status;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+    MPI_Comm_rank(io_comm, &io_rank);
+    MPI_Comm_size(io_comm, &num_io);
+
+    if (c->binary_output)
+        TrajOpen(c->fname, c->numboids, c->numticks, c->sidelen_x, c->sidelen_y, c->dt,
+                 c->frames_per_write, c->start_tick, io_comm);
+    else
+        ResumeTextOutput(c->fname, c->numboids, c->start_tick, io_comm);
+
+    for (tick = c->start_tick; !stop; ++tick) {
+        n = 0;
+        for (client = 0; client < num_compute; ++client) {
+            if (IoServerOf(client, num_compute, num_io) != myrank)
+                continue;
+
+            MPI_Probe(client, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+            MPI_Get_count(&status, MPI_BYTE, &bytes);
+
+            if (status.MPI_TAG == IO_STOP_TAG) {
+                MPI_Recv(NULL, 0, MPI_BYTE, client, IO_STOP_TAG, MPI_COMM_WORLD,
+                         MPI_STATUS_IGNORE);
+                stop = 1;
+                continue;
+            }
+
+            if (n + bytes / (int) sizeof(Boid) > capacity) {
+                capacity = n + bytes / sizeof(Boid);
+                capacity += capacity / 2;
+                boids = (Boid*) realloc(boids, capacity * sizeof(Boid));
+            }
+
+            MPI_Recv(boids + n, bytes, MPI_BYTE, client, IO_TAG, MPI_COMM_WORLD,
+                     MPI_STATUS_IGNORE);
+            n += bytes / sizeof(Boid);
+        }
+
+        if (stop)
+            break;
+        else if (c->binary_output)
+            TrajWrite(boids, n, tick);
+        else
+            WriteRankData(c->fname, boids, n, c->numboids, tick, io_rank, num_io, io_comm);
+    }
+
+    if (c->binary_output)
+        TrajClose();
+
+    free(boids);
+}
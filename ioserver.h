@@ -0,0 +1,31 @@
+#ifndef _IOSERVER_H_
+#define _IOSERVER_H_
+
+#include "boid.h"
+#include "io.h"
+#include <mpi.h>
+
+/* Dedicated output ranks. With io_ranks = M in the config, the last M ranks of
+   MPI_COMM_WORLD don't simulate. Every tick each compute rank copies its boids
+   into one of two snapshot buffers and sends it off without waiting, and the
+   I/O ranks collect the snapshots and write them with the usual text or binary
+   writer. Compute ranks are split into M contiguous groups, one per I/O rank,
+   so the file comes out in the same order as without I/O ranks */
+
+#define IO_TAG 100
+#define IO_STOP_TAG 101
+
+/* Which world rank serves compute rank c */
+int IoServerOf(int, int, int);
+
+/* Compute side. Hands this tick's boids to the I/O rank */
+void IoSend(Boid*, int, int);
+
+/* Compute side. Waits for the last snapshots to be taken, and tells the I/O
+   rank there are no more */
+void IoFinish(int);
+
+/* I/O side. Receives and writes ticks until the compute ranks stop, then returns */
+void IoServe(Config*, MPI_Comm, int);
+
+#endif
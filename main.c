@@ -5,39 +5,94 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "simulator.h"
-#include "clcg4.h"
 #include "boid.h"
 #include "init.h"
 #include "io.h"
+#include "ioserver.h"
+#include "checkpoint.h"
+#include "timer.h"
 
 int
 main(int argc, char** argv)
 {
-    int myrank, numranks, mynumboids, i;
+    int myrank, numranks, mynumboids, i, provided, is_io;
     double starttime = 0.0;
     Boid* boids = NULL;
     Config* c = NULL;
+    MPI_Comm comm;
 
-    /* MPI and clcg4 initialization */
-    MPI_Init( &argc, &argv);
+    /* MPI initialization. Only the main thread ever calls MPI */
+    MPI_Init_thread( &argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_size( MPI_COMM_WORLD, &numranks);
     MPI_Comm_rank( MPI_COMM_WORLD, &myrank);
-    InitDefault();
+
+    if (provided < MPI_THREAD_FUNNELED) {
+        if (myrank == 0)
+            fprintf(stderr, "This MPI doesn't support MPI_THREAD_FUNNELED, which OpenMP "
+                    "threads need\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
 
     if (myrank == 0)
         starttime = MPI_Wtime();
 
     c = ReadConfig(argv[1]);
 
-    /* Initialize boids and simulator */
-    Initialize(&boids, c, &mynumboids, myrank, numranks);
-    InitializeSim(boids, c, myrank,  mynumboids, numranks);
+    /* A restarted run takes its boids, tick and physical parameters from the checkpoint */
+    CheckpointCatchSignals();
+    if (c->restart)
+        c->start_tick = CheckpointReadHeader(c, MPI_COMM_WORLD);
+
+#ifdef _OPENMP
+    if (c->threads > 0)
+        omp_set_num_threads(c->threads);
+#endif
+
+    if (c->io_ranks < 0 || c->io_ranks >= numranks) {
+        if (myrank == 0)
+            fprintf(stderr, "io_ranks has to leave at least one rank to simulate\n");
+        exit(1);
+    }
+
+    /* The last io_ranks ranks only write output. Everyone else simulates, and uses
+       comm wherever they would have used MPI_COMM_WORLD */
+    is_io = myrank >= numranks - c->io_ranks;
+    MPI_Comm_split(MPI_COMM_WORLD, is_io, myrank, &comm);
+    numranks -= c->io_ranks;
+
+    if (is_io) {
+        MPI_Barrier( MPI_COMM_WORLD );
+        IoServe(c, comm, numranks);
+    }
+    else {
+        /* Initialize boids and simulator */
+        if (c->restart)
+            CheckpointRead(c, &boids, &mynumboids, myrank, numranks, comm);
+        else
+            Initialize(&boids, c, &mynumboids, myrank, numranks, comm);
+        InitializeSim(boids, c, myrank,  mynumboids, numranks, comm);
+
+        /* Make sure everybody is initialized before beginning iteration */
+        MPI_Barrier( MPI_COMM_WORLD );
+        for (i = c->start_tick; i < c->numticks; ++i) {
+            Iterate(i);
+
+            /* Checkpoints resume at the next tick. After a signal, stop once it's saved */
+            if (StopRequested() || (c->checkpoint_every > 0 && (i + 1) % c->checkpoint_every == 0))
+                CheckpointSim(c, i + 1);
+            if (StopRequested())
+                break;
+        }
+        FinalizeSim();
+
+        if (c->timers)
+            TimerReport(c->numboids, comm);
+    }
 
-    /* Make sure everybody is initialized before beginning iteration */
-    MPI_Barrier( MPI_COMM_WORLD );
-    for (i = 0; i < c->numticks; ++i)
-        Iterate(i);
     /* Make sure everybody finishes iterating before completing sim */
     MPI_Barrier( MPI_COMM_WORLD );
 
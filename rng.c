@@ -0,0 +1,94 @@
+#include "rng.h"
+#include <stdio.h>
+#include <time.h>
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+/*
+ * Philox4x32-10 from Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3".
+ * The counter is (id, tick, purpose, 0) and the key is the 64 bit seed. Ten rounds
+ * of multiplies and xors are enough to pass BigCrush for any counter and key.
+ * Only plain 32 x 32 -> 64 bit multiplies are used, so loops over it vectorize
+ */
+static inline void
+Philox(uint64_t seed, uint32_t id, uint32_t tick, uint32_t purpose, uint32_t* out)
+{
+    int round;
+    uint64_t p0, p1;
+    uint32_t c0 = id, c1 = tick, c2 = purpose, c3 = 0;
+    uint32_t k0 = (uint32_t) seed, k1 = (uint32_t) (seed >> 32);
+
+    for (round = 0; round < 10; ++round) {
+        p0 = (uint64_t) PHILOX_M0 * c0;
+        p1 = (uint64_t) PHILOX_M1 * c2;
+        c0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+        c2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t) p1;
+        c3 = (uint32_t) p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+/* Turns 53 random bits from two words into a double in [0, 1) */
+static inline double
+ToUniform(uint32_t hi, uint32_t lo)
+{
+    return (double) (((uint64_t) hi << 21) ^ (lo >> 11)) * (1.0 / 9007199254740992.0);
+}
+
+void
+RngWords(uint64_t seed, uint32_t id, uint32_t tick, uint32_t purpose, uint32_t* out)
+{
+    Philox(seed, id, tick, purpose, out);
+}
+
+void
+RngUniform2(uint64_t seed, uint32_t id, uint32_t tick, uint32_t purpose, double* u)
+{
+    uint32_t w[4];
+    Philox(seed, id, tick, purpose, w);
+    u[0] = ToUniform(w[0], w[1]);
+    u[1] = ToUniform(w[2], w[3]);
+}
+
+/* Since every draw is independent, threads and vector lanes just split the ids */
+void
+RngUniformBatch(uint64_t seed, const uint32_t* ids, int n, uint32_t tick, uint32_t purpose,
+                double* out)
+{
+    int i;
+    uint32_t w[4];
+
+    #pragma omp parallel for simd private(w)
+    for (i = 0; i < n; ++i) {
+        Philox(seed, ids[i], tick, purpose, w);
+        out[i] = ToUniform(w[0], w[1]);
+    }
+}
+
+/*
+ * A negative seed in the config means a different run every time. Rank 0 picks it so
+ * every rank agrees, and prints it so the run can be repeated
+ */
+int
+RngResolveSeed(int seed, int myrank, MPI_Comm comm)
+{
+    if (seed >= 0)
+        return seed;
+
+    if (myrank == 0) {
+        seed = (int) (time(NULL) & 0x7fffffff);
+        printf("Using seed %i\n", seed);
+    }
+    MPI_Bcast(&seed, 1, MPI_INT, 0, comm);
+    return seed;
+}
@@ -0,0 +1,29 @@
+#ifndef _RNG_H_
+#define _RNG_H_
+
+#include <stdint.h>
+#include <mpi.h>
+
+/* What a random number is for, so draws for the same boid and tick that are used
+   for different things never repeat each other */
+#define RNG_POSITION 0
+#define RNG_HEADING 1
+#define RNG_TURN 2
+
+/* Counter based random numbers (Philox4x32-10). A draw is a pure function of
+   (seed, id, tick, purpose), so it doesn't matter which rank or thread makes it,
+   or in what order. There is no generator state to seed, share or carry around */
+
+/* Four random 32 bit words for (seed, id, tick, purpose) */
+void RngWords(uint64_t, uint32_t, uint32_t, uint32_t, uint32_t*);
+
+/* Two uniform numbers in [0, 1) for (seed, id, tick, purpose) */
+void RngUniform2(uint64_t, uint32_t, uint32_t, uint32_t, double*);
+
+/* out[i] is a uniform number in [0, 1) for (seed, ids[i], tick, purpose) */
+void RngUniformBatch(uint64_t, const uint32_t*, int, uint32_t, uint32_t, double*);
+
+/* Picks a seed from the clock on rank 0 and shares it, if seed is negative */
+int RngResolveSeed(int, int, MPI_Comm);
+
+#endif
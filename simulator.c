@@ -1,12 +1,30 @@
 
 #include "simulator.h"
-#include "clcg4.h"
+#include "cell.h"
+#include "exchange.h"
+#include "rng.h"
+#include "traj.h"
+#include "ioserver.h"
+#include "checkpoint.h"
+#include "analytics.h"
+#include "cluster.h"
+#include "timer.h"
+#include "arena.h"
 #include "io.h"
+#include "init.h"
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <mpi.h>
-#include <assert.h>
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_thread_num() 0
+#define omp_get_num_threads() 1
+#define omp_get_max_threads() 1
+#endif
 
 /*
  * Global statics. Persistent between iteration calls. C version of having nice class variables
@@ -14,8 +32,11 @@
  * Everything else derived from these are made into functions
  */
 static Boid* boids;
+static MPI_Comm sim_comm;
 static char* fname;
 static int seed;
+static int tick;
+static int ticks_run;
 static int myrank;
 static int numranks;
 static int mynumboids;
@@ -24,16 +45,104 @@ static double dt;
 static double noise;
 static double boid_v;
 static double cutoff;
-static double sidelen;
+static double sidelen_x;
+static double sidelen_y;
+static int dims[2];
+static double* xcuts;
+static double* ycuts;
+static int balance_every;
+static int binary_output;
+static int io_server;
+static int stop_requested;
+static int stop_signals[2];
+static MPI_Request stop_request = MPI_REQUEST_NULL;
+static int check_level;
+static int check_every;
+static uint64_t id_checksum;
+static int use_cells;
+static int cutoff_halo;
+static int use_soa;
+static BoidArrays all_arrays;
+static int exact_align;
+static double* sum_vx;
+static double* sum_vy;
+static double* turn;
+static unsigned int* turn_ids;
+static long long neighbor_sum;
+static int overlap;
+static int use_verlet;
+static double skin;
+static double halo_reach;
+static double sum_scale;
+static int verlet_stale = 1;
+static int verlet_rebuilds;
+static int verlet_ticks;
+static int* neighbor_ranks;
+static int num_neighbors;
+static MPI_Comm graph_comm = MPI_COMM_NULL;
+static Exchange halo_exchange;
+static Exchange migrate_exchange;
+static CellList cells;
+static Clusters clusters;
+static int* halo_index;
+
+/* Everything a tick needs scratch space for. These only grow, so after the first few ticks
+   a tick makes no heap allocations. boids lives in boid_buffer, so arriving boids can be
+   appended to it */
+static Buffer boid_buffer;
+static Buffer thread_counts;
+static Buffer all_buffer;
+static Buffer halo_send;
+static Buffer halo_counts;
+static Buffer halo_flags;
+static Buffer halo_indices;
+static Buffer migrate_send;
+static Buffer migrate_counts;
+static Buffer migrate_displs;
+static Buffer migrate_dest;
+static Buffer migrate_index;
+static Buffer cluster_displs;
+static Buffer cluster_labels;
+static Buffer graph_weights;
+
+/* Verlet lists, kept from one rebuild to the next. The list of local boid i is
+   verlet_list[verlet_start[i]] .. verlet_list[verlet_start[i + 1] - 1], as indices
+   into the boids and halo boids of a tick. Those only stay put because between
+   rebuilds nothing migrates, and every neighbor gets the same halo boids in the same
+   order. verlet_origin is where each boid was at the rebuild, and verlet_ghosts
+   flags lists holding halo boids */
+static Buffer verlet_start;
+static Buffer verlet_list;
+static Buffer verlet_origin;
+static Buffer verlet_ghosts;
+static Buffer verlet_images;
+static Buffer verlet_image_of;
+static Buffer sort_cells;
+static Buffer sort_counts;
+static Buffer sort_buffer;
+static Buffer sum_vx_buffer;
+static Buffer sum_vy_buffer;
+static Buffer turn_buffer;
+static Buffer turn_ids_buffer;
+
+/* Mixes a boid id into the checksum SanityCheck compares against id_checksum */
+static uint64_t IdHash(uint64_t);
 
 /*
  * Basic initialization of static variables based off Config struct, read in from ini file,
  * as well as MPI specific variables
  */
 void
-InitializeSim(Boid* b, Config* c, int mr, int mnb, int nr)
+InitializeSim(Boid* b, Config* c, int mr, int mnb, int nr, MPI_Comm comm)
 {
+    int i, e;
+    long long id, first_id, last_id;
+    uint64_t mine = 0;
+
     boids = b;
+    boid_buffer.data = b;
+    boid_buffer.size = mnb * sizeof(Boid);
+    sim_comm = comm;
     myrank = mr;
     numranks = nr;
     mynumboids = mnb;
@@ -44,299 +153,858 @@ InitializeSim(Boid* b, Config* c, int mr, int mnb, int nr)
     fname = c->fname;
     noise = c->noise;
     cutoff = c->cutoff;
-    sidelen = c->sidelen;
+    sidelen_x = c->sidelen_x;
+    sidelen_y = c->sidelen_y;
+    RankDims(numranks, sidelen_x, sidelen_y, dims);
+
+    /* Rank boxes start out equal, and only move if load balancing is on. Row j covers
+       [ycuts[j], ycuts[j + 1]), and each row has its own column cuts, so column i of
+       row j covers [x[i], x[i + 1]) with x = RowCuts(xcuts, j) */
+    xcuts = (double*) CountedMalloc( dims[1] * (dims[0] + 1) * sizeof(double) );
+    ycuts = (double*) CountedMalloc( (dims[1] + 1) * sizeof(double) );
+    for (i = 0; i < dims[1] * (dims[0] + 1); ++i)
+        xcuts[i] = (i % (dims[0] + 1)) * sidelen_x / dims[0];
+    for (i = 0; i <= dims[1]; ++i)
+        ycuts[i] = i * sidelen_y / dims[1];
     global_numboids = c->numboids;
+    use_cells = c->cell_list;
+    cutoff_halo = c->cutoff_halo;
+    use_soa = c->soa;
+    exact_align = c->exact_align;
+    overlap = c->overlap;
+    use_verlet = c->verlet_skin > 0.0;
+    skin = c->verlet_skin;
+    halo_reach = use_verlet ? cutoff + skin : cutoff;
+
+    /* Neighbor sums are in fixed point, at the largest power of two that keeps every
+       boid's velocity added together below 2^62, so they don't depend on the order the
+       decomposition hands the neighbors over in */
+    frexp(global_numboids * 1.02 * (boid_v > 0.0 ? boid_v : 1.0), &e);
+    sum_scale = ldexp(1.0, 62 - e);
+    balance_every = c->balance_every;
+    binary_output = c->binary_output;
+    check_level = c->check_level;
+    check_every = c->check_every > 0 ? c->check_every : 1;
+
+    /* Every id from 0 to numboids - 1 should be on some rank. Each rank hashes its
+       share of the ids, and the sum is what the checksums of the boids themselves have
+       to add up to */
+    if (check_level > 0) {
+        first_id = (long long) myrank * global_numboids / numranks;
+        last_id = (long long) (myrank + 1) * global_numboids / numranks;
+        for (id = first_id; id < last_id; ++id)
+            mine += IdHash(id);
+        MPI_Allreduce(&mine, &id_checksum, 1, MPI_UINT64_T, MPI_SUM, sim_comm);
+    }
+
+    /* With I/O ranks, boids are handed to them instead of being written here */
+    io_server = -1;
+    if (c->io_ranks > 0)
+        io_server = IoServerOf(myrank, numranks, c->io_ranks);
+    else if (binary_output)
+        TrajOpen(fname, global_numboids, c->numticks, sidelen_x, sidelen_y, dt,
+                 c->frames_per_write, c->start_tick, sim_comm);
+    else
+        ResumeTextOutput(fname, global_numboids, c->start_tick, sim_comm);
+
+    AnalyticsOpen(c->analytics_file, c->analytics_every, global_numboids, boid_v,
+                  c->start_tick, sim_comm);
+    ClustersOpen(c->cluster_file, c->cluster_every, c->start_tick, sim_comm);
+
+    /* The polynomials in VecAlignBatch are only accurate for turns up to pi */
+    if (noise > 2 * M_PI)
+        exact_align = 1;
+
+    /* Neighbors only change when the load balancer moves rank boundaries, so they are
+       handed to MPI as a graph communicator that all halo and migration traffic goes
+       through */
+    Neighbors(&neighbor_ranks, &num_neighbors);
+    BuildGraph();
+}
+
+/*
+ * Creates the graph communicator over neighbor_ranks, and the halo and migration
+ * exchanges on top of it, replacing any from before
+ */
+void
+BuildGraph(void)
+{
+    int i;
+    int* weights;
+
+    if (graph_comm != MPI_COMM_NULL) {
+        ExchangeFree(&halo_exchange);
+        ExchangeFree(&migrate_exchange);
+        MPI_Comm_free(&graph_comm);
+    }
+
+    /* Even weights rather than MPI_UNWEIGHTED, which is a made up pointer that GCC
+       warns about reading from, with at least one so a rank without neighbors
+       still passes a real array */
+    weights = (int*) BufferReserve(&graph_weights, (num_neighbors + 1) * sizeof(int));
+    for (i = 0; i < num_neighbors; ++i)
+        weights[i] = 1;
+    MPI_Dist_graph_create_adjacent(sim_comm, num_neighbors, neighbor_ranks, weights,
+                                   num_neighbors, neighbor_ranks, weights, MPI_INFO_NULL,
+                                   0, &graph_comm);
+
+    /* Block sizes start at a rank's fair share of boids for the halo, and small for
+       migration, then adapt to what is actually sent */
+    ExchangeInit(&halo_exchange, graph_comm, neighbor_ranks, num_neighbors,
+                 global_numboids / numranks, 1);
+    ExchangeInit(&migrate_exchange, graph_comm, neighbor_ranks, num_neighbors, 16, 2);
+
+    /* Per neighbor counts only change size here, so they're made ready here too, even
+       if nothing migrates for a while */
+    BufferReserve(&halo_counts, 2 * num_neighbors * sizeof(int));
+    BufferReserve(&migrate_counts, num_neighbors * sizeof(int));
+    BufferReserve(&migrate_displs, 2 * num_neighbors * sizeof(int));
 }
 
 /*
- * Driver of the simulator. Called with ticknum so sending and receiving from other MPI ranks
- * can only be done among the same ticknum (used as MPI send/recv tag)
+ * Driver of the simulator. Called with ticknum so output for each timestep lands in the right
+ * place
  */
 void
 Iterate(int ticknum)
 {
-    double avg_norm_v;
     Boid* all_boids = NULL;
-    int* neighbor_ranks = NULL;
     Boid* neighbor_boids = NULL;
-    int* num_neighbor_boids = NULL;
-    int num_neighbors, neighbor_total;
-
-    /* Find who rank numbers of neighbor ranks */
-    Neighbors(&neighbor_ranks, &num_neighbors);
+    Boid* send_boids = NULL;
+    int* num_send = NULL;
+    int* send_displs = NULL;
+    int neighbor_total;
+
+    tick = ticknum;
+    neighbor_sum = 0;
+    TimerMark();
+
+    /* Verlet lists get rebuilt this tick. Boids near each other are put near each other
+       in memory first, so the boids in a list are too */
+    if (use_verlet && verlet_stale)
+        SortBoids();
+
+    /* Pick out which boids each neighbor rank needs to see */
+    send_boids = PackHaloBoids(&num_send, &send_displs);
+    TimerLap(PHASE_HALO_PACK);
+
+    if (overlap) {
+        /* Get the halo boids moving, and do everything that doesn't need them while
+           they're in flight */
+        ExchangeStart(&halo_exchange, send_boids, num_send, send_displs);
+        TimerLap(PHASE_HALO_EXCHANGE);
+
+        WriteOutput(ticknum);
+        TimerLap(PHASE_OUTPUT);
+
+        /* Boids further than cutoff from every edge only have local neighbors */
+        SumNeighbors(boids, mynumboids, INTERIOR_BOIDS);
+        TimerLap(PHASE_VELOCITY);
+
+        neighbor_boids = ExchangeFinish(&halo_exchange, &neighbor_total);
+        TimerLap(PHASE_HALO_EXCHANGE);
+        all_boids = ConcatenateBoids(neighbor_boids, neighbor_total);
+        TimerLap(PHASE_CONCATENATE);
+
+        SumNeighbors(all_boids, mynumboids + neighbor_total, BOUNDARY_BOIDS);
+        AlignVelocities();
+        TimerLap(PHASE_VELOCITY);
+    }
+    else {
+        /* Actually send boids */
+        neighbor_boids = SendRecvBoids(send_boids, num_send, send_displs, &neighbor_total);
+        TimerLap(PHASE_HALO_EXCHANGE);
 
-    /* Make sure each rank has the number of neighbor boids it's supposed to receive */
-    num_neighbor_boids = SendRecvNumBoids(neighbor_ranks, num_neighbors, ticknum);
+        /* Smashes SendRecvBoids lists into one list for easy iteration */
+        all_boids = ConcatenateBoids(neighbor_boids, neighbor_total);
+        TimerLap(PHASE_CONCATENATE);
 
-    /* Actually send boids */
-    neighbor_boids = SendRecvBoids(neighbor_ranks, num_neighbor_boids, num_neighbors, ticknum);
+        /* Write all data before changing. Uses MPI IO for parallelism */
+        WriteOutput(ticknum);
+        TimerLap(PHASE_OUTPUT);
 
-    /* Finds the total number of neighbor boids from other ranks */
-    neighbor_total = TotalNeighborBoids(num_neighbor_boids, num_neighbors);
+        UpdateVelocity(all_boids, neighbor_total);
+        TimerLap(PHASE_VELOCITY);
+    }
 
-    /* Smashes SendRecvBoids lists into one list for easy iteration */
-    all_boids = ConcatenateBoids(neighbor_boids, neighbor_total);
+    /* Every so often, find the flocks, while positions and halo boids are still this tick's */
+    if (ClustersDue(ticknum)) {
+        FindClusters(all_boids, neighbor_total, num_send, send_displs);
+        TimerLap(PHASE_CLUSTERS);
+    }
 
-    /* Write all data before changing. Uses MPI IO for parallelism */
-    WriteRankData(fname, boids, mynumboids, global_numboids, ticknum, myrank, numranks);
+    /* Update position. Times itself, since it also migrates */
+    UpdatePosition();
 
-    /* Update position and velocity */
-    UpdateVelocity(all_boids, neighbor_total);
-    UpdatePosition(neighbor_ranks, num_neighbors, ticknum);
+    /* Every so often, even out how many boids each rank holds */
+    if (balance_every > 0 && (ticknum + 1) % balance_every == 0) {
+        Rebalance(ticknum);
+        TimerLap(PHASE_BALANCE);
+    }
 
-    /* Calculates statistic used in Tamas's paper */
-    avg_norm_v = AverageNormalizedVelocity();
+    /* Order parameter from Tamas's paper, and the other numbers in the analytics file */
+    AnalyticsTick(boids, mynumboids, neighbor_sum, ticknum);
+    TimerLap(PHASE_ANALYTICS);
 
-    /* Makes sure no boids have been lost, and all boids are where they're supposed to be. In the
-       interest of speed, this function should probably be commented out for production runs */
+    /* Makes sure no boids have been lost, and all boids are where they're supposed to be, as
+       often and as thoroughly as check_level asks. Also where ranks agree on stopping */
     SanityCheck();
+    TimerLap(PHASE_SANITY);
+
+    TimerTickEnd();
+
+    /* Boid counts wander as flocks form and drift across rank edges, so once the warmup
+       ticks have shown roughly what each rank sees, every buffer is grown ahead of it.
+       Later ticks then only allocate if a rank's load more than doubles. This happens
+       between ticks, so it isn't charged to any phase */
+    if (++ticks_run == TIMER_WARMUP_TICKS)
+        GrowBuffers();
 }
 
 /*
- * Calculates parameter dictating how ordered the boids are for the phase change behaviors.
- * See Tamas's paper for more details. Currently this function is called by doesn't actually output
- * anywhere
+ * Writes this tick's boids, in whichever format the config asked for
  */
-double
-AverageNormalizedVelocity(void)
+void
+WriteOutput(int ticknum)
 {
-    /* Each rank calculates its local part */
-    int i;
-    double vx = 0.0, vy = 0.0;
-    double* vx_list = NULL;
-    double* vy_list = NULL;
-    for (i = 0; i < mynumboids; ++i) {
-        vx += boids[i].v.x;
-        vy += boids[i].v.y;
-    }
+    if (io_server >= 0)
+        IoSend(boids, mynumboids, io_server);
+    else if (binary_output)
+        TrajWrite(boids, mynumboids, ticknum);
+    else
+        WriteRankData(fname, boids, mynumboids, global_numboids, ticknum, myrank, numranks,
+                      sim_comm);
+}
 
-    /* Only rank 0 does the summing. All other ranks just return 0 at the end */
-    if (myrank == 0) {
-        vx_list = (double*) calloc(numranks, sizeof(double));
-        vy_list = (double*) calloc(numranks, sizeof(double));
-    }
+/*
+ * Closes anything the simulator kept open for the whole run, and frees the neighbor
+ * search's scratch. Called once after the last tick
+ */
+void
+FinalizeSim(void)
+{
+    if (io_server >= 0)
+        IoFinish(io_server);
+    else if (binary_output)
+        TrajClose();
+
+    AnalyticsClose();
+    ClustersClose(&clusters);
+    CellListFree(&cells);
+    BoidArraysFree(&all_arrays);
+    MPI_Wait(&stop_request, MPI_STATUS_IGNORE);
+
+    if (use_verlet && myrank == 0)
+        printf("Verlet lists rebuilt %i times in %i ticks\n", verlet_rebuilds, verlet_ticks);
+}
 
-    MPI_Gather(&vx, 1, MPI_DOUBLE, vx_list, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    MPI_Gather(&vy, 1, MPI_DOUBLE, vy_list, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+/*
+ * Writes every rank's boids to a checkpoint the run can be restarted from at tick
+ */
+void
+CheckpointSim(Config* c, int tick)
+{
+    CheckpointWrite(c, boids, mynumboids, tick, sim_comm);
+}
 
-    if (myrank == 0) {
-        vx = 0.0;
-        vy = 0.0;
+/*
+ * Whether any rank has been signalled to stop. Agreed on by every rank in SanityCheck, so
+ * they all stop after the same tick
+ */
+int
+StopRequested(void)
+{
+    return stop_requested;
+}
 
-        for (i = 0; i < numranks; ++i) {
-            vx += vx_list[i];
-            vy += vy_list[i];
+/*
+ * Runs through boids and updates their positions based off their velocities
+ * Enforces global boundary conditions, and lists the boids that moved out of
+ * territory controlled by their rank on the way, so that migration only ever
+ * looks at those. Each thread lists the leavers in its own stretch of boids at
+ * the start of that stretch, and the lists are joined up afterwards.
+ *
+ * With Verlet lists, also checks whether any boid is more than skin / 2 from
+ * where it was when the lists were built. Until one is, nothing migrates
+ */
+void
+UpdatePosition(void)
+{
+    double newx, newy, dx, dy;
+    double xmin = xMin();
+    double xmax = xMax();
+    double ymin = yMin();
+    double ymax = yMax();
+    double max_drift2 = skin * skin / 4;
+    double* origin = (double*) verlet_origin.data;
+    int i, t, lo, hi, count;
+    int num_threads = 1, num_leaving = 0, drifted = 0;
+    int check_drift = use_verlet && !verlet_stale;
+    int* leaving = (int*) BufferReserve(&migrate_index, mynumboids * sizeof(int));
+    int* counts = (int*) BufferReserve(&thread_counts, omp_get_max_threads() * sizeof(int));
+
+    #pragma omp parallel private(i, t, lo, hi, count, newx, newy, dx, dy) reduction(|:drifted)
+    {
+        t = omp_get_thread_num();
+        lo = (long long) mynumboids * t / omp_get_num_threads();
+        hi = (long long) mynumboids * (t + 1) / omp_get_num_threads();
+        count = 0;
+        if (t == 0)
+            num_threads = omp_get_num_threads();
+
+        for (i = lo; i < hi; ++i) {
+            newx = boids[i].r.x + boids[i].v.x * dt;
+            newy = boids[i].r.y + boids[i].v.y * dt;
+
+            /* Enforce global periodic boundary conditions */
+            if (newx >= sidelen_x) newx -= sidelen_x;
+            if (newy >= sidelen_y) newy -= sidelen_y;
+            if (newx < 0.0) newx += sidelen_x;
+            if (newy < 0.0) newy += sidelen_y;
+
+            boids[i].r.x = newx;
+            boids[i].r.y = newy;
+
+            if (newx < xmin || newx >= xmax || newy < ymin || newy >= ymax)
+                leaving[lo + count++] = i;
+
+            /* Distance from where the lists were built, the short way round the
+               periodic edges */
+            if (check_drift) {
+                dx = fabs(newx - origin[2 * i]);
+                dy = fabs(newy - origin[2 * i + 1]);
+                if (dx > sidelen_x / 2) dx = sidelen_x - dx;
+                if (dy > sidelen_y / 2) dy = sidelen_y - dy;
+                if (dx * dx + dy * dy > max_drift2)
+                    drifted = 1;
+            }
         }
+        counts[t] = count;
+    }
 
-        return sqrt(vx * vx + vy * vy) / (global_numboids * boid_v);
+    for (t = 0; t < num_threads; ++t) {
+        lo = (long long) mynumboids * t / num_threads;
+        memmove(leaving + num_leaving, leaving + lo, counts[t] * sizeof(int));
+        num_leaving += counts[t];
+    }
+    TimerLap(PHASE_POSITION);
+
+    /* Every rank has to rebuild at once, since lists point into the halo, so one int
+       decides it. Until then boids stay on their rank, however far past the box they
+       drift. Leavers from earlier ticks are still outside the box, so they're listed
+       along with this tick's once it's time to go */
+    if (use_verlet) {
+        ++verlet_ticks;
+        if (check_drift) {
+            MPI_Allreduce(MPI_IN_PLACE, &drifted, 1, MPI_INT, MPI_LOR, sim_comm);
+            if (!drifted) {
+                TimerLap(PHASE_MIGRATION);
+                return;
+            }
+            verlet_stale = 1;
+        }
     }
 
-    return 0.0;
+    /* Sends out-of-place boids to required ranks */
+    RearrangeBoids(leaving, num_leaving);
+    TimerLap(PHASE_MIGRATION);
 }
 
 
 /*
- * Runs through boids and updates their positions based off their velocities
- * Enforces global boundary conditions and makes sure that if a boid moves
- * out of territory controlled by its rank, it is moved to the appropriate rank
+ * Finds which boids are outside this rank's box after the box moved, and sends them to
+ * the neighbor rank that owns them now
  */
 void
-UpdatePosition(int* neighbor_ranks, int num_neighbors, int ticknum)
+MigrateBoids(void)
 {
-    double newx, newy;
-    int i, rank, idx;
-
-    /* Initialize to 0, parallels neighbor_ranks array */
-    int* num_to_send = (int*) calloc(num_neighbors, sizeof(int));
-    int* index_cache = (int*) calloc(mynumboids, sizeof(int));
+    int i, num_leaving = 0;
+    double xmin = xMin();
+    double xmax = xMax();
+    double ymin = yMin();
+    double ymax = yMax();
+    int* leaving = (int*) BufferReserve(&migrate_index, mynumboids * sizeof(int));
 
     for (i = 0; i < mynumboids; ++i) {
-        newx = boids[i].r.x + boids[i].v.x * dt;
-        newy = boids[i].r.y + boids[i].v.y * dt;
-
-        /* Enforce global periodic boundary conditions */
-        if (newx > sidelen) newx -= sidelen;
-        if (newy > sidelen) newy -= sidelen;
-        if (newx < 0.0) newx += sidelen;
-        if (newy < 0.0) newy += sidelen;
-
-        boids[i].r.x = newx;
-        boids[i].r.y = newy;
-        rank = CheckLocalBoundaries(newx, newy);
-
-        /* Checks if current boid needs to be sent to a different rank */
-        if (rank != myrank) {
-            idx = IndexOf(neighbor_ranks, num_neighbors, rank);
-            num_to_send[idx]++;
-            index_cache[i] = idx;
-        }
-        else
-            index_cache[i] = -1;
+        if (boids[i].r.x < xmin || boids[i].r.x >= xmax ||
+            boids[i].r.y < ymin || boids[i].r.y >= ymax)
+            leaving[num_leaving++] = i;
     }
 
-    /* Sends out-of-place boids to required ranks */
-    RearrangeBoids(neighbor_ranks, num_to_send, index_cache, num_neighbors, ticknum);
-
-    free(num_to_send);
-    free(index_cache);
+    RearrangeBoids(leaving, num_leaving);
 }
 
 
 /*
- * Takes the information generated in UpdatePosition, and moves out-of-place
- * boids to different ranks
+ * Sends the boids listed in leaving, in increasing order, to the neighbor ranks that own
+ * them now. Only those boids are looked at, so a tick where few boids cross a boundary
+ * migrates for next to nothing however many boids the rank holds
  */
 void
-RearrangeBoids(int* neighbor_ranks, int* num_send, int* index_cache, int num_neighbors, int ticknum)
+RearrangeBoids(int* leaving, int num_leaving)
 {
-    int i, j, idx, rank;
+    int i, k, rank;
     int total_sent = 0;
-    int total_recv = 0;
-    int* num_recv = (int*) calloc(num_neighbors, sizeof(int));
-    Boid** boid_send = (Boid**) calloc(num_neighbors, sizeof(Boid*));
-    Boid** boid_recv = (Boid**) calloc(num_neighbors, sizeof(Boid*));
-
-    MPI_Request* send_r = (MPI_Request*) calloc(num_neighbors, sizeof(MPI_Request));
-    MPI_Request* recv_r = (MPI_Request*) calloc(num_neighbors, sizeof(MPI_Request));
+    int* num_send = (int*) BufferReserve(&migrate_counts, num_neighbors * sizeof(int));
+    int* displs = (int*) BufferReserve(&migrate_displs, 2 * num_neighbors * sizeof(int));
+    int* cursor = displs + num_neighbors;
+    int* dest = (int*) BufferReserve(&migrate_dest, num_leaving * sizeof(int));
+    Boid* boid_send;
+
+    // Finds which neighbor each leaving boid goes to. A boid right on the far
+    // edge of the box can land back on this rank, and stays
+    memset(num_send, 0, num_neighbors * sizeof(int));
+    for (i = 0, k = 0; i < num_leaving; ++i) {
+        rank = CheckLocalBoundaries(boids[leaving[i]].r.x, boids[leaving[i]].r.y);
+        if (rank == myrank)
+            continue;
+
+        leaving[k] = leaving[i];
+        dest[k] = IndexOf(neighbor_ranks, num_neighbors, rank);
+        num_send[dest[k]]++;
+        ++k;
+    }
+    num_leaving = k;
 
-    // Prepares boids that need to be sent, and send the number of boids
-    // to recv'd on the other end
+    // Packs the boids that need to be sent, grouped by destination
     for (i = 0; i < num_neighbors; ++i) {
-        idx = 0;
-        rank = neighbor_ranks[i];
-
-        MPI_Isend(&num_send[i], 1, MPI_INT, rank, ticknum, MPI_COMM_WORLD, &send_r[i]);
-        MPI_Irecv(&num_recv[i], 1, MPI_INT, rank, ticknum, MPI_COMM_WORLD, &recv_r[i]);
-
-        if (num_send[i] > 0) {
-            total_sent += num_send[i];
-            boid_send[i] = (Boid*) calloc(num_send[i], sizeof(Boid));
-            for (j = 0; j < mynumboids; ++j) {
-                if (index_cache[j] == i)
-                    boid_send[i][idx++] = boids[j];
-            }
-        }
+        displs[i] = cursor[i] = total_sent;
+        total_sent += num_send[i];
     }
+    boid_send = (Boid*) BufferReserve(&migrate_send, total_sent * sizeof(Boid));
+    for (i = 0; i < num_leaving; ++i)
+        boid_send[cursor[dest[i]]++] = boids[leaving[i]];
+
+    // Sends the boids along with how many there are, in one round, and fills
+    // in the holes they leave while they're on their way
+    ExchangeStart(&migrate_exchange, boid_send, num_send, displs);
+    RecombineBoids(leaving, num_leaving);
+}
 
-    MPI_Waitall(num_neighbors, send_r, MPI_STATUSES_IGNORE);
-    MPI_Waitall(num_neighbors, recv_r, MPI_STATUSES_IGNORE);
 
-    // Sends actual boids
-    for (i = 0; i < num_neighbors; ++i) {
-        rank = neighbor_ranks[i];
-        if (num_send[i] > 0) {
-            MPI_Isend(boid_send[i], num_send[i] * sizeof(Boid), MPI_BYTE, rank, ticknum,
-                      MPI_COMM_WORLD, &send_r[i]);
-        }
 
-        if (num_recv[i] > 0) {
-            total_recv += num_recv[i];
-            boid_recv[i] = (Boid*) calloc(num_recv[i], sizeof(Boid));
-            MPI_Irecv(boid_recv[i], num_recv[i] * sizeof(Boid), MPI_BYTE, rank, ticknum,
-                      MPI_COMM_WORLD, &recv_r[i]);
-        }
 
-    }
+// Takes the boids in leaving, in increasing order, out of the boid array by
+// moving the last boid into each hole, from the highest hole down, so every
+// boid moved into a hole is one that stays. Then appends the boids neighbors
+// sent straight onto the end of the array. Only leaving and arriving boids are
+// copied, but boids that stay don't keep their order
+void RecombineBoids(int* leaving, int num_leaving)
+{
+    int i, total_recv;
+
+    for (i = num_leaving - 1; i >= 0; --i)
+        boids[leaving[i]] = boids[--mynumboids];
+
+    total_recv = ExchangeWait(&migrate_exchange);
+    boids = (Boid*) BufferReserve(&boid_buffer, (mynumboids + total_recv) * sizeof(Boid));
+    ExchangeUnpack(&migrate_exchange, boids + mynumboids);
+    mynumboids += total_recv;
+}
 
-    MPI_Waitall(num_neighbors, send_r, MPI_STATUSES_IGNORE);
-    MPI_Waitall(num_neighbors, recv_r, MPI_STATUSES_IGNORE);
 
-    // After receiving or getting rid of boids, recombines them into an
-    // intelligible form
-    RecombineBoids(boid_recv, num_recv, index_cache, num_neighbors, total_sent, total_recv);
 
-    for (i = 0; i < num_neighbors; ++i) {
-        if (num_recv[i] > 0)
-            free(boid_recv[i]);
-        if (num_send[i] > 0)
-            free(boid_send[i]);
-    }
 
-    free(boid_recv);
-    free(boid_send);
-    free(num_recv);
-    free(send_r);
-    free(recv_r);
+// Grows every buffer a tick goes through to GROW_HEADROOM times the most it
+// has held so far. Buffers that never held anything stay empty. Contents are
+// kept, though boids and halo_index may have moved.
+//
+// With Verlet lists, migration waits for a rebuild and then moves everything
+// that drifted out at once, which the warmup may never have seen. Every boid
+// leaving for a neighbor was in the halo sent to it, and every boid arriving
+// was in the halo received, so the migration buffers are made as big as the
+// halo's
+void GrowBuffers()
+{
+    Buffer* buffers[] = {
+        &boid_buffer, &all_buffer, &halo_send, &halo_flags, &halo_indices, &migrate_send,
+        &migrate_dest, &migrate_index, &cluster_labels, &verlet_list, &verlet_start,
+        &verlet_origin, &verlet_ghosts, &verlet_images, &verlet_image_of, &sort_cells,
+        &sort_buffer, &sum_vx_buffer, &sum_vy_buffer, &turn_buffer, &turn_ids_buffer
+    };
+    int i;
+
+    for (i = 0; i < (int) (sizeof(buffers) / sizeof(buffers[0])); ++i)
+        BufferGrow(buffers[i]);
+    boids = (Boid*) boid_buffer.data;
+    halo_index = (int*) halo_indices.data;
+    CellListGrow(&cells);
+    BoidArraysGrow(&all_arrays);
+    ExchangeGrow(&halo_exchange);
+    ExchangeGrow(&migrate_exchange);
+    ClustersGrow(&clusters);
+    if (binary_output && io_server < 0)
+        TrajGrow();
+
+    if (use_verlet) {
+        BufferReserve(&migrate_send, halo_send.size);
+        BufferReserve(&migrate_dest, halo_indices.size);
+        boids = (Boid*) BufferReserve(&boid_buffer, all_buffer.size);
+        ExchangeReserve(&migrate_exchange, halo_exchange.send_size, halo_exchange.recv_size);
+    }
 }
 
 
 
 
-// "Flattens" boids, and makes sure mynumboids matches the number of boids
-// associated with this rank
-void RecombineBoids(Boid** boid_recv, int* num_recv, int* index_cache, int num_neighbors,
-                    int total_sent, int total_recv)
+// Orders boids by which cell of width halo_reach in the rank's box they're
+// in, row by row, with a counting sort. Boids stray past the box between
+// Verlet list rebuilds, so positions off the grid count as its nearest cell.
+// Halo boids are packed in the same order, so neighbors get them sorted too
+void SortBoids()
 {
-    int i, j;
-    int idx = 0;
-    int new_total = mynumboids + total_recv - total_sent;
-    Boid* new_boids;
+    int i, c, cx, cy, sum = 0;
+    double xmin = xMin();
+    double ymin = yMin();
+    int nx = (int) ((xMax() - xmin) / halo_reach);
+    int ny = (int) ((yMax() - ymin) / halo_reach);
+    int* cell = (int*) BufferReserve(&sort_cells, mynumboids * sizeof(int));
+    int* start;
+    Boid* sorted = (Boid*) BufferReserve(&sort_buffer, mynumboids * sizeof(Boid));
 
-    new_boids = (Boid*) calloc(new_total, sizeof(Boid));
+    if (nx < 1) nx = 1;
+    if (ny < 1) ny = 1;
+    start = (int*) BufferReserve(&sort_counts, nx * ny * sizeof(int));
+    memset(start, 0, nx * ny * sizeof(int));
 
     for (i = 0; i < mynumboids; ++i) {
-        if (index_cache[i] == -1) {
-            new_boids[idx++] = boids[i];
-        }
+        cx = (int) ((boids[i].r.x - xmin) / halo_reach);
+        cy = (int) ((boids[i].r.y - ymin) / halo_reach);
+        cx = cx < 0 ? 0 : (cx >= nx ? nx - 1 : cx);
+        cy = cy < 0 ? 0 : (cy >= ny ? ny - 1 : cy);
+        cell[i] = cx + cy * nx;
+        start[cell[i]]++;
     }
 
-    for (i = 0; i < num_neighbors; ++i) {
-        if (num_recv[i] > 0) {
-            for (j = 0; j < num_recv[i]; ++j) {
-                new_boids[idx++] = boid_recv[i][j];
-            }
-        }
+    for (c = 0; c < nx * ny; ++c) {
+        sum += start[c];
+        start[c] = sum - start[c];
     }
 
-    free(boids);
-    boids = new_boids;
-    mynumboids = new_total;
+    for (i = 0; i < mynumboids; ++i)
+        sorted[start[cell[i]]++] = boids[i];
+    memcpy(boids, sorted, mynumboids * sizeof(Boid));
+}
+
+
+
+
+// The finalizer from splitmix64. Sums of these over a set of ids only match
+// by chance when the sets differ, however the ids are spread over ranks
+static uint64_t IdHash(uint64_t id)
+{
+    id = (id ^ (id >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    id = (id ^ (id >> 27)) * 0x94d049bb133111ebULL;
+    return id ^ (id >> 31);
 }
 
 
 
 
-// Checks to make sure that all boids are in the proper spaces, and that no
-// boids have been lost globally. Crashes program if any checks are not met
+// Checks that no boids have been lost or duplicated globally, and that boids
+// are in their rank's box and no faster than v. Level 2 checks every boid
+// every tick. Level 1 checks every check_every ticks, and only every
+// CHECK_SAMPLE'th boid, starting somewhere different each time. Level 0
+// checks nothing.
+//
+// Lost and duplicated boids show up in the boid count and in a sum of hashed
+// ids, which go in the same reduction as the count of ranks signalled to
+// stop. A failed check prints the rank, tick and boid, and aborts the run.
+//
+// Level 0 still has to agree on stopping, so every rank stops after the same
+// tick, but doesn't wait for it. The count of signalled ranks goes out in an
+// MPI_Iallreduce every check_every ticks, and is only collected at the next
+// one, by which time it has long since arrived. A signal then takes up to
+// twice check_every ticks to stop the run.
+//
+// Between Verlet list rebuilds boids are left wherever they drift, which is
+// never more than skin / 2 past the box, maybe around a periodic edge. Those
+// are only checked to be within skin of it, to stay clear of rounding
 void SanityCheck()
 {
-    int i, total_boids;
+    int i, stride, outside;
+    uint64_t sum = 0;
+    uint64_t local[3], total[3];
     double xmin = xMin();
     double ymin = yMin();
     double xmax = xMax();
     double ymax = yMax();
+    double box[4] = {xmin, xmax, ymin, ymax};
+    double point[4];
+    double max_v2 = 1.01 * boid_v * 1.01 * boid_v;
+    double v2;
     Boid b;
 
-    // Sums up the number of boids on each rank
-    MPI_Allreduce(&mynumboids, &total_boids, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (check_level < 2 && (tick + 1) % check_every != 0)
+        return;
 
-    assert(total_boids == global_numboids);
+    if (check_level == 0) {
+        MPI_Wait(&stop_request, MPI_STATUS_IGNORE);
+        stop_requested = stop_signals[1] > 0;
+        stop_signals[0] = CheckpointSignalled();
+        MPI_Iallreduce(&stop_signals[0], &stop_signals[1], 1, MPI_INT, MPI_SUM, sim_comm,
+                       &stop_request);
+        return;
+    }
 
-    for (i = 0; i < mynumboids; ++i) {
+    #pragma omp parallel for reduction(+:sum)
+    for (i = 0; i < mynumboids; ++i)
+        sum += IdHash(boids[i].id);
+
+    local[0] = mynumboids;
+    local[1] = sum;
+    local[2] = CheckpointSignalled();
+    MPI_Allreduce(local, total, 3, MPI_UINT64_T, MPI_SUM, sim_comm);
+    stop_requested = total[2] > 0;
+
+    if (total[0] != (uint64_t) global_numboids || total[1] != id_checksum) {
+        if (myrank == 0) {
+            if (total[0] != (uint64_t) global_numboids)
+                fprintf(stderr, "Tick %i: %llu boids across all ranks instead of %i\n", tick,
+                        (unsigned long long) total[0], global_numboids);
+            else
+                fprintf(stderr, "Tick %i: boid ids lost and duplicated, though the count is right\n",
+                        tick);
+        }
+        MPI_Abort(sim_comm, 1);
+    }
+
+    stride = check_level > 1 ? 1 : CHECK_SAMPLE;
+    for (i = (tick / check_every) % stride; i < mynumboids; i += stride) {
         b = boids[i];
 
-        assert(sqrt(b.v.x * b.v.x + b.v.y * b.v.y) <= boid_v * 1.01);
-        assert(b.r.x < xmax);
-        assert(b.r.x > xmin);
-        assert(b.r.y < ymax);
-        assert(b.r.y > ymin);
+        v2 = b.v.x * b.v.x + b.v.y * b.v.y;
+        if (v2 > max_v2) {
+            fprintf(stderr, "Rank %i, tick %i: boid %u has speed %g, more than v = %g\n", myrank,
+                    tick, b.id, sqrt(v2), boid_v);
+            MPI_Abort(sim_comm, 1);
+        }
+        if (use_verlet && !verlet_stale) {
+            point[0] = point[1] = b.r.x;
+            point[2] = point[3] = b.r.y;
+            outside = !BoxesNear(point, box, skin, 1);
+        }
+        else
+            outside = b.r.x < xmin || b.r.x >= xmax || b.r.y < ymin || b.r.y >= ymax;
+
+        if (outside) {
+            fprintf(stderr, "Rank %i, tick %i: boid %u at (%g, %g) is outside the rank's box "
+                    "[%g, %g) x [%g, %g)\n", myrank, tick, b.id, b.r.x, b.r.y, xmin, xmax, ymin,
+                    ymax);
+            MPI_Abort(sim_comm, 1);
+        }
+    }
+}
+
+
+
+
+// Moves the rank boundaries so every rank holds about the same number of
+// boids, then sends boids to wherever they belong now.
+//
+// The rows of ranks are balanced first, from a histogram of every boid along
+// y. Then each row gets its own column cuts, from a histogram along x of just
+// the boids in that row, so a clump only squeezes the ranks it sits in. Both
+// histograms are added up with an Allreduce, so every rank works out the same
+// cuts. Only counts are balanced, not time spent, so a rank with a very dense
+// clump still does more work than the rest.
+//
+// Boids that drifted out of their box since the last Verlet list rebuild go
+// home first, over the graph they drifted within, and the lists are rebuilt
+// after
+void Rebalance(int ticknum)
+{
+    int i, j, bin;
+    int nx = NumRanksX();
+    int ny = NumRanksY();
+    int nbins_x = BALANCE_BINS * nx;
+    int nbins_y = BALANCE_BINS * ny;
+    int* hist;
+    double* old_xcuts = (double*) CountedMalloc( ny * (nx + 1) * sizeof(double) );
+    double* old_ycuts = (double*) CountedMalloc( (ny + 1) * sizeof(double) );
+    double after, before = Imbalance();
+
+    if (use_verlet && !verlet_stale)
+        MigrateBoids();
+    verlet_stale = 1;
+
+    memcpy(old_xcuts, xcuts, ny * (nx + 1) * sizeof(double));
+    memcpy(old_ycuts, ycuts, (ny + 1) * sizeof(double));
+
+    hist = (int*) CountedCalloc(nbins_y, sizeof(int));
+    for (i = 0; i < mynumboids; ++i) {
+        bin = (int) (boids[i].r.y / sidelen_y * nbins_y);
+        hist[bin < nbins_y ? bin : nbins_y - 1]++;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, hist, nbins_y, MPI_INT, MPI_SUM, sim_comm);
+    BalanceCuts(hist, nbins_y, sidelen_y, ycuts, ny);
+    free(hist);
+
+    hist = (int*) CountedCalloc(ny * nbins_x, sizeof(int));
+    for (i = 0; i < mynumboids; ++i) {
+        j = CutIndex(ycuts, ny, boids[i].r.y);
+        bin = (int) (boids[i].r.x / sidelen_x * nbins_x);
+        hist[j * nbins_x + (bin < nbins_x ? bin : nbins_x - 1)]++;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, hist, ny * nbins_x, MPI_INT, MPI_SUM, sim_comm);
+    for (j = 0; j < ny; ++j)
+        BalanceCuts(hist + j * nbins_x, nbins_x, sidelen_x, RowCuts(xcuts, j), nx);
+    free(hist);
+
+    // Once rows have different column cuts, a boid can end up owned by a rank
+    // that wasn't a neighbor, so it moves over a graph linking every pair of
+    // ranks where one's old box overlaps the other's new box. After that the
+    // neighbors are found again for the new boxes
+    free(neighbor_ranks);
+    MovedNeighbors(old_xcuts, old_ycuts, &neighbor_ranks, &num_neighbors);
+    BuildGraph();
+    MigrateBoids();
+
+    free(neighbor_ranks);
+    Neighbors(&neighbor_ranks, &num_neighbors);
+    BuildGraph();
+
+    free(old_xcuts);
+    free(old_ycuts);
+
+    after = Imbalance();
+    if (myrank == 0)
+        printf("Tick %i: rebalanced, imbalance %f -> %f\n", ticknum, before, after);
+}
+
+
+
+
+// Lists the ranks whose box under one set of cuts overlaps this rank's box
+// under the other, which is everyone boids can move between when the cuts
+// change. The relation is symmetric, as a graph communicator needs
+void MovedNeighbors(double* old_xcuts, double* old_ycuts, int** ranks, int* n)
+{
+    int rank;
+    double old_box[4], new_box[4], box[4];
+
+    RankBox(myrank, old_xcuts, old_ycuts, old_box);
+    RankBox(myrank, xcuts, ycuts, new_box);
+
+    *ranks = (int*) CountedCalloc( numranks, sizeof(int) );
+    *n = 0;
+    for (rank = 0; rank < numranks; ++rank) {
+        if (rank == myrank)
+            continue;
+
+        RankBox(rank, xcuts, ycuts, box);
+        if (BoxesNear(old_box, box, 0.0, 0)) {
+            (*ranks)[(*n)++] = rank;
+            continue;
+        }
+
+        RankBox(rank, old_xcuts, old_ycuts, box);
+        if (BoxesNear(new_box, box, 0.0, 0))
+            (*ranks)[(*n)++] = rank;
     }
 }
 
 
 
 
+// Places the n - 1 inner cuts over [0, len] so each of the n slices gets the
+// same share of the boids counted in hist, interpolating within a bin.
+//
+// A new cut is kept between the old cuts on either side of it, so boxes
+// change gradually and a slice only ever overlaps its own old slice and the
+// two next to it. Slices are also kept at least halo_reach wide, so cell
+// lists and halos stay sensible. Both old and new cuts are the same on every rank
+void BalanceCuts(int* hist, int nbins, double len, double* cuts, int n)
+{
+    int i, k, bin = 0;
+    long total = 0, below = 0;
+    double target;
+    double* next = (double*) CountedMalloc( (n + 1) * sizeof(double) );
+
+    for (i = 0; i < nbins; ++i)
+        total += hist[i];
+    if (total == 0 || n == 1) {
+        free(next);
+        return;
+    }
+
+    next[0] = 0.0;
+    next[n] = len;
+    for (k = 1; k < n; ++k) {
+        target = (double) total * k / n;
+        while (bin < nbins - 1 && below + hist[bin] < target)
+            below += hist[bin++];
+
+        next[k] = len / nbins * (bin + (hist[bin] ? (target - below) / hist[bin] : 0.0));
+
+        if (next[k] < cuts[k - 1]) next[k] = cuts[k - 1];
+        if (next[k] > cuts[k + 1]) next[k] = cuts[k + 1];
+    }
+
+    // Push cuts apart to the minimum width, first from the left edge, then
+    // from the right. The old cuts were already far enough apart, so this
+    // never moves a cut past its old neighbors
+    for (k = 1; k < n; ++k) {
+        if (next[k] < next[k - 1] + halo_reach)
+            next[k] = next[k - 1] + halo_reach;
+    }
+    for (k = n - 1; k > 0; --k) {
+        if (next[k] > next[k + 1] - halo_reach)
+            next[k] = next[k + 1] - halo_reach;
+    }
+
+    for (k = 1; k < n; ++k)
+        cuts[k] = next[k];
+    free(next);
+}
+
+
+
+
+// Finds the slice [cuts[i], cuts[i + 1]) holding v, out of n slices. Anything
+// past either end lands in the first or last slice
+int CutIndex(double* cuts, int n, double v)
+{
+    int lo = 0, hi = n - 1, mid;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (v >= cuts[mid])
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+
+
+
+// Largest number of boids on one rank over the average number per rank. 1 is
+// perfectly balanced. Has to be called by every rank
+double Imbalance()
+{
+    int max_boids;
+    MPI_Allreduce(&mynumboids, &max_boids, 1, MPI_INT, MPI_MAX, sim_comm);
+    return max_boids / ((double) global_numboids / numranks);
+}
+
+
+
+
 // I know this is inefficient, but I'm not creating a binary search tree or
-// hash table just to search through, at maximum, 8 values
-int IndexOf(int* neighbor_ranks, int num_neighbors, int rank)
+// hash table just to search through a rank's handful of neighbors. A boid
+// headed for any other rank can't be sent, so the whole run stops
+int IndexOf(int* ranks, int n, int rank)
 {
     int i;
-    for (i = 0; i < num_neighbors; ++i) {
-        if (neighbor_ranks[i] == rank)
+    for (i = 0; i < n; ++i) {
+        if (ranks[i] == rank)
             return i;
     }
-    fprintf(stderr, "Boid moved outside 8 neighbors");
-    exit(1);
+    fprintf(stderr, "Rank %i, tick %i: a boid moved to rank %i, which isn't one of its %i "
+            "neighbors\n", myrank, tick, rank, n);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+    return -1;
 }
 
 
@@ -345,9 +1013,8 @@ int IndexOf(int* neighbor_ranks, int num_neighbors, int rank)
 // Checks the rank the position (x, y) belongs to
 int CheckLocalBoundaries(double x, double y)
 {
-    int xquad = (int) floor(x / xGrid());
-    int yquad = (int) floor(y / yGrid());
-    return QuadToRank(xquad, yquad);
+    int yquad = CutIndex(ycuts, NumRanksY(), y);
+    return QuadToRank(CutIndex(RowCuts(xcuts, yquad), NumRanksX(), x), yquad);
 }
 
 
@@ -357,138 +1024,444 @@ int CheckLocalBoundaries(double x, double y)
 // in the neighboring 8 ranks (if numranks > 4)
 void UpdateVelocity(Boid* all_boids, int neighbor_total)
 {
-    int i, j, neighbors, total_count = neighbor_total + mynumboids;
-    double v_x, v_y, angle;
-    Vec v;
-    srand( time(NULL) );
-    int seed = rand() % Maxgen;
+    SumNeighbors(all_boids, neighbor_total + mynumboids, ALL_BOIDS);
+    AlignVelocities();
+}
+
 
+
+
+// Sums the velocities of every boid in src within cutoff of each local boid
+// in part, into sum_vx, sum_vy. part lets the interior boids, which can only
+// have local neighbors, be done while halo boids are still on their way.
+//
+// With use_cells, only the 3x3 block of cells around each boid is searched
+// instead of all of src. With use_soa the boids are searched as a structure
+// of arrays copy using the vectorized kernel in boid.c, rather than calling
+// BoidDist pair by pair. Verlet lists take over from both, and when they're
+// due to be rebuilt the interior pass leaves everything to the boundary pass,
+// which has the halo boids the lists need
+void SumNeighbors(Boid* src, int total_count, int part)
+{
+    int i, j, neighbors;
+    long long others = 0, v_x, v_y;
+    double cutoff2 = cutoff * cutoff;
+    unsigned char* ghosts;
+    int* start;
+    int* list;
+
+    if (use_verlet && verlet_stale) {
+        if (part == INTERIOR_BOIDS)
+            return;
+        BuildVerletLists(src, total_count);
+        part = ALL_BOIDS;
+    }
+    ghosts = (unsigned char*) verlet_ghosts.data;
+    start = (int*) verlet_start.data;
+    list = (int*) verlet_list.data;
+
+    /* Only boids within cutoff of the rank's box can be neighbors of a local boid, so
+       the grid covers the box plus a ring of width cutoff. Verlet lists are searched
+       with the vectorized kernel too, through their indices */
+    if (use_verlet)
+        BoidsToArrays(src, total_count, &all_arrays);
+    else if (use_cells)
+        CellListBuild(&cells, src, total_count, xMin() - cutoff, xMax() + cutoff,
+                      yMin() - cutoff, yMax() + cutoff, cutoff);
+    else if (use_soa)
+        BoidsToArrays(src, total_count, &all_arrays);
+
+    sum_vx = (double*) BufferReserve(&sum_vx_buffer, mynumboids * sizeof(double));
+    sum_vy = (double*) BufferReserve(&sum_vy_buffer, mynumboids * sizeof(double));
+    turn = (double*) BufferReserve(&turn_buffer, mynumboids * sizeof(double));
+    turn_ids = (unsigned int*) BufferReserve(&turn_ids_buffer, mynumboids * sizeof(unsigned int));
+
+    /* Boids in dense areas take longer, so threads grab small chunks as they go */
+    #pragma omp parallel for private(j, neighbors, v_x, v_y) \
+                             reduction(+:others) schedule(dynamic, 64)
     for (i = 0; i < mynumboids; ++i) {
-        neighbors = 0;
-        v_x = 0.0;
-        v_y = 0.0;
-        for (j = 0; j < total_count; ++j) {
-            if ( BoidDist(boids[i], all_boids[j]) < cutoff ) {
-                ++neighbors;
-                v_x += all_boids[j].v.x;
-                v_y += all_boids[j].v.y;
+        if (part != ALL_BOIDS &&
+            (part == INTERIOR_BOIDS) != (use_verlet ? !ghosts[i] : IsInterior(boids[i].r)))
+            continue;
+
+        if (use_verlet) {
+            v_x = 0;
+            v_y = 0;
+            neighbors = BoidArraysSumList(&all_arrays, list + start[i], start[i + 1] - start[i],
+                                          boids[i].r.x, boids[i].r.y, cutoff2, sum_scale,
+                                          &v_x, &v_y);
+        }
+        else if (use_cells && use_soa) {
+            neighbors = CellListSumArrays(&cells, boids[i].r.x, boids[i].r.y, cutoff2,
+                                          sum_scale, &v_x, &v_y);
+        }
+        else if (use_cells) {
+            neighbors = CellListSum(&cells, src, boids[i], cutoff, sum_scale, &v_x, &v_y);
+        }
+        else if (use_soa) {
+            v_x = 0;
+            v_y = 0;
+            neighbors = BoidArraysSum(&all_arrays, 0, total_count, boids[i].r.x, boids[i].r.y,
+                                      cutoff2, sum_scale, &v_x, &v_y);
+        }
+        else {
+            neighbors = 0;
+            v_x = 0;
+            v_y = 0;
+            for (j = 0; j < total_count; ++j) {
+                if ( BoidDist(boids[i], src[j]) < cutoff ) {
+                    ++neighbors;
+                    v_x += llrint(src[j].v.x * sum_scale);
+                    v_y += llrint(src[j].v.y * sum_scale);
+                }
             }
         }
-        v.x = v_x / (double) neighbors;
-        v.y = v_y / (double) neighbors;
-        angle = VecAngle(v) + noise * (GenVal(seed) - 0.5);
-        VecSetAngle(&v, angle);
-        VecSetLength(&v, boid_v);
 
-        boids[i].v = v;
+        /* Every boid counts itself, so neighbors is never 0 */
+        sum_vx[i] = v_x / sum_scale / (double) neighbors;
+        sum_vy[i] = v_y / sum_scale / (double) neighbors;
+        others += neighbors - 1;
     }
 
-    free(all_boids);
+    neighbor_sum += others;
 }
 
 
 
 
-// Concatenates boids from simulator with boids found in 8 neighbor ranks, and
-// returns them
-Boid* ConcatenateBoids(Boid* neighbor_boids, int neighbor_total)
+// Lists, for each local boid, every boid in src within cutoff + skin of it,
+// itself included, as indices into src. The search runs over copies of src
+// shifted across the periodic edges too, so a boid that wraps around before
+// the next rebuild is already in the lists of the boids it lands next to.
+// Whether a pair is within cutoff is only ever decided on the real positions,
+// so nothing connects across the edges any more than it does without lists.
+//
+// Local boids are all inside the box at a rebuild, so they go first and
+// unshifted. Lists are counted, then filled, both in parallel. Also saves
+// where every boid was, and which lists hold halo boids
+void BuildVerletLists(Boid* src, int total_count)
 {
-    int total_count = neighbor_total + mynumboids;
-    Boid* all_boids = (Boid*) calloc(total_count, sizeof(Boid));
-    int i, idx = 0;
+    int i, k, a, b, n = mynumboids;
+    double x, y, reach2 = halo_reach * halo_reach;
+    double xmin = xMin() - halo_reach;
+    double xmax = xMax() + halo_reach;
+    double ymin = yMin() - halo_reach;
+    double ymax = yMax() + halo_reach;
+    Boid* images = (Boid*) BufferReserve(&verlet_images, total_count * sizeof(Boid));
+    int* image_of = (int*) BufferReserve(&verlet_image_of, total_count * sizeof(int));
+    int* start = (int*) BufferReserve(&verlet_start, (mynumboids + 1) * sizeof(int));
+    double* origin = (double*) BufferReserve(&verlet_origin, 2 * mynumboids * sizeof(double));
+    unsigned char* ghosts = (unsigned char*) BufferReserve(&verlet_ghosts, mynumboids);
+    int* list;
+
+    memcpy(images, src, mynumboids * sizeof(Boid));
     for (i = 0; i < mynumboids; ++i)
-        all_boids[idx++] = boids[i];
+        image_of[i] = i;
+
+    for (k = 0; k < total_count; ++k) {
+        for (a = -1; a <= 1; ++a) {
+            for (b = -1; b <= 1; ++b) {
+                x = src[k].r.x + a * sidelen_x;
+                y = src[k].r.y + b * sidelen_y;
+                if ((k < mynumboids && a == 0 && b == 0) ||
+                    x < xmin || x >= xmax || y < ymin || y >= ymax)
+                    continue;
+
+                images = (Boid*) BufferReserve(&verlet_images, (n + 1) * sizeof(Boid));
+                image_of = (int*) BufferReserve(&verlet_image_of, (n + 1) * sizeof(int));
+                images[n] = src[k];
+                images[n].r.x = x;
+                images[n].r.y = y;
+                image_of[n++] = k;
+            }
+        }
+    }
+    CellListBuild(&cells, images, n, xmin, xmax, ymin, ymax, halo_reach);
 
-    for (i = 0; i < neighbor_total; ++i)
-        all_boids[idx++] = neighbor_boids[i];
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (i = 0; i < mynumboids; ++i)
+        start[i + 1] = CellListNear(&cells, src[i].r.x, src[i].r.y, reach2, NULL);
 
-    free(neighbor_boids);
+    start[0] = 0;
+    for (i = 0; i < mynumboids; ++i)
+        start[i + 1] += start[i];
+    list = (int*) BufferReserve(&verlet_list, start[mynumboids] * sizeof(int));
 
-    return all_boids;
+    #pragma omp parallel for private(k) schedule(dynamic, 64)
+    for (i = 0; i < mynumboids; ++i) {
+        CellListNear(&cells, src[i].r.x, src[i].r.y, reach2, list + start[i]);
+
+        ghosts[i] = 0;
+        for (k = start[i]; k < start[i + 1]; ++k) {
+            list[k] = image_of[list[k]];
+            ghosts[i] |= list[k] >= mynumboids;
+        }
+
+        origin[2 * i] = src[i].r.x;
+        origin[2 * i + 1] = src[i].r.y;
+    }
+
+    verlet_stale = 0;
+    ++verlet_rebuilds;
 }
 
 
 
 
-// Counts the total number of neighbors in neighboring 8 ranks  based of
-// num_neighbor_boids array
-int TotalNeighborBoids(int* num_neighbor_boids, int num_neighbors)
+// Calls link(i, j, data) for every boid j within cutoff of each local boid i,
+// other than i itself, out of the Verlet lists, like CellListPairs does from
+// a cell list
+void VerletPairs(Boid* all_boids, void (*link)(int, int, void*), void* data)
 {
-    int i, neighbor_total = 0;
-    for (i = 0; i < num_neighbors; ++i)
-        neighbor_total += num_neighbor_boids[i];
+    int i, j, k;
+    int* start = (int*) verlet_start.data;
+    int* list = (int*) verlet_list.data;
 
-    return neighbor_total;
+    for (i = 0; i < mynumboids; ++i) {
+        for (k = start[i]; k < start[i + 1]; ++k) {
+            j = list[k];
+            if (j != i && BoidDist(all_boids[i], all_boids[j]) < cutoff)
+                link(i, j, data);
+        }
+    }
 }
 
 
 
 
-// Sends and receives boids from neighboring 8 ranks
-Boid* SendRecvBoids(int* neighbor_ranks, int* num_neighbor_boids,
-                    int num_neighbors, int ticknum)
+// Turns each boid towards the average heading found by SumNeighbors, plus
+// noise. Unless exact_align is set, the new headings are computed in one batch
+// by VecAlignBatch instead of going through VecAngle and VecSetAngle per boid.
+// The noise for a boid is keyed by its id and the tick, so it's the same no
+// matter which rank or thread the boid is on
+void AlignVelocities()
 {
+    int i;
+    double angle;
+    Vec v;
 
-    int i, j, rank, idx = 0;
-    int neighbor_total = TotalNeighborBoids(num_neighbor_boids, num_neighbors);
+    for (i = 0; i < mynumboids; ++i)
+        turn_ids[i] = boids[i].id;
+    RngUniformBatch(seed, turn_ids, mynumboids, tick, RNG_TURN, turn);
 
-    Boid* neighbor_boids = (Boid*) calloc(neighbor_total, sizeof(Boid));
-    Boid** temp_boids = (Boid**) calloc(num_neighbors, sizeof(Boid*));
+    #pragma omp parallel for
+    for (i = 0; i < mynumboids; ++i)
+        turn[i] = noise * (turn[i] - 0.5);
+
+    if (exact_align) {
+        #pragma omp parallel for private(v, angle)
+        for (i = 0; i < mynumboids; ++i) {
+            v.x = sum_vx[i];
+            v.y = sum_vy[i];
+            angle = VecAngle(v) + turn[i];
+            VecSetAngle(&v, angle);
+            VecSetLength(&v, boid_v);
+
+            boids[i].v = v;
+        }
+    }
+    else {
+        VecAlignBatch(sum_vx, sum_vy, turn, mynumboids, boid_v);
+        #pragma omp parallel for
+        for (i = 0; i < mynumboids; ++i) {
+            boids[i].v.x = sum_vx[i];
+            boids[i].v.y = sum_vy[i];
+        }
+    }
+}
 
-    MPI_Request* send_r = (MPI_Request*) calloc(num_neighbors, sizeof(MPI_Request));
-    MPI_Request* recv_r = (MPI_Request*) calloc(num_neighbors, sizeof(MPI_Request));
 
-    for (i = 0; i < num_neighbors; ++i) {
-        rank = neighbor_ranks[i];
-        temp_boids[i] = (Boid*) calloc( num_neighbor_boids[i], sizeof(Boid));
-        MPI_Isend(boids, mynumboids * sizeof(Boid), MPI_BYTE, rank, ticknum, MPI_COMM_WORLD, &send_r[i]);
-        MPI_Irecv(temp_boids[i], num_neighbor_boids[i] * sizeof(Boid), MPI_BYTE, rank, ticknum,
-                  MPI_COMM_WORLD, &recv_r[i]);
+
+
+// Checks that a position is at least cutoff away from every edge of this
+// rank, so nothing from another rank can be its neighbor
+int IsInterior(Vec r)
+{
+    return r.x - xMin() >= cutoff && xMax() - r.x >= cutoff &&
+           r.y - yMin() >= cutoff && yMax() - r.y >= cutoff;
+}
+
+
+
+
+// Concatenates boids from simulator with boids found in 8 neighbor ranks, and
+// returns them. The array is reused by the next call
+Boid* ConcatenateBoids(Boid* neighbor_boids, int neighbor_total)
+{
+    int total_count = neighbor_total + mynumboids;
+    Boid* all_boids = (Boid*) BufferReserve(&all_buffer, total_count * sizeof(Boid));
+
+    memcpy(all_boids, boids, mynumboids * sizeof(Boid));
+    memcpy(all_boids + mynumboids, neighbor_boids, neighbor_total * sizeof(Boid));
+
+    return all_boids;
+}
+
+
+
+
+// Sends and receives boids from neighboring ranks. The num_send[i] boids going
+// to neighbor_ranks[i] start at send_boids[send_displs[i]]. Counts travel with
+// the boids, so this is one round of messages
+Boid* SendRecvBoids(Boid* send_boids, int* num_send, int* send_displs, int* neighbor_total)
+{
+    ExchangeStart(&halo_exchange, send_boids, num_send, send_displs);
+    return ExchangeFinish(&halo_exchange, neighbor_total);
+}
+
+
+
+
+// Builds the send buffer for the halo exchange, where the num_send[i] boids
+// for neighbor_ranks[i] start at send_displs[i]. Without cutoff_halo every
+// neighbor gets the whole boids array, and nothing is copied. With it, only
+// boids within cutoff of a neighbor's box are sent, which works out to a strip
+// of width cutoff along each shared edge and a cutoff x cutoff patch at each
+// shared corner. Everything returned is reused by the next call.
+//
+// With Verlet lists the halo reaches cutoff + skin, and Verlet lists point at
+// halo boids by where they are in it, so until the next rebuild each neighbor
+// gets the same boids as last time, in the same order, just copied again
+Boid* PackHaloBoids(int** num_send, int** send_displs)
+{
+    int i, j, total = 0;
+    double xmin = xMin() + halo_reach;
+    double ymin = yMin() + halo_reach;
+    double xmax = xMax() - halo_reach;
+    double ymax = yMax() - halo_reach;
+    Boid* send_boids;
+    unsigned char* in_halo;
+
+    *num_send = (int*) BufferReserve(&halo_counts, 2 * num_neighbors * sizeof(int));
+    *send_displs = *num_send + num_neighbors;
+
+    if (use_verlet && !verlet_stale) {
+        if (!cutoff_halo)
+            return boids;
+
+        for (j = 0; j < num_neighbors; ++j)
+            total += (*num_send)[j];
+        send_boids = (Boid*) halo_send.data;
+        for (i = 0; i < total; ++i)
+            send_boids[i] = boids[halo_index[i]];
+        return send_boids;
     }
 
-    MPI_Waitall(num_neighbors, send_r, MPI_STATUSES_IGNORE);
-    MPI_Waitall(num_neighbors, recv_r, MPI_STATUSES_IGNORE);
+    memset(*num_send, 0, 2 * num_neighbors * sizeof(int));
 
-    // Linearize boids for easy running later
-    for (i = 0; i < num_neighbors; ++i) {
-        for (j = 0; j < num_neighbor_boids[i]; ++j) {
-            neighbor_boids[idx++] = temp_boids[i][j];
+    if (!cutoff_halo) {
+        for (i = 0; i < num_neighbors; ++i)
+            (*num_send)[i] = mynumboids;
+        return boids;
+    }
+
+    // First pass flags and counts. Boids further than halo_reach from every
+    // edge of this rank can't be in anyone's halo, which skips most of the checks
+    in_halo = (unsigned char*) BufferReserve(&halo_flags, mynumboids * num_neighbors);
+    memset(in_halo, 0, mynumboids * num_neighbors);
+    for (i = 0; i < mynumboids; ++i) {
+        if (boids[i].r.x >= xmin && boids[i].r.x <= xmax &&
+            boids[i].r.y >= ymin && boids[i].r.y <= ymax)
+            continue;
+
+        for (j = 0; j < num_neighbors; ++j) {
+            if (InRankHalo(boids[i].r, neighbor_ranks[j])) {
+                in_halo[i * num_neighbors + j] = 1;
+                (*num_send)[j]++;
+            }
         }
-        free(temp_boids[i]);
     }
 
-    free(send_r);
-    free(recv_r);
-    free(temp_boids);
+    // Second pass copies into each neighbor's stretch of the send buffer
+    for (j = 0; j < num_neighbors; ++j) {
+        (*send_displs)[j] = total;
+        total += (*num_send)[j];
+        (*num_send)[j] = 0;
+    }
+    send_boids = (Boid*) BufferReserve(&halo_send, total * sizeof(Boid));
+    halo_index = (int*) BufferReserve(&halo_indices, total * sizeof(int));
+    for (i = 0; i < mynumboids; ++i) {
+        for (j = 0; j < num_neighbors; ++j) {
+            if (in_halo[i * num_neighbors + j]) {
+                halo_index[(*send_displs)[j] + (*num_send)[j]] = i;
+                send_boids[(*send_displs)[j] + (*num_send)[j]++] = boids[i];
+            }
+        }
+    }
 
-    return neighbor_boids;
+    return send_boids;
 }
 
 
 
 
-// Sends and receives the number of boids, so MPI knows how much to receive
-// in a later call
-int* SendRecvNumBoids(int* neighbor_ranks, int num_neighbors, int ticknum)
+// Joins boids closer than cutoff into clusters and writes the histogram of
+// cluster sizes. Pairs are found on a cell list of this rank's boids and the
+// halo boids the tick already received, then labels are traded with the
+// neighbors over the graph communicator until they settle. Each neighbor gets
+// the labels of the boids it got in the halo, in the same order, so they line
+// up with its copies. halo_index says which local boid each of those was.
+// With Verlet lists, pairs come from those instead, since they also know
+// about boids that drifted out of the box since the last rebuild.
+//
+// Halo boids aren't shifted across the periodic edges, so like the velocity
+// update, boids only connect within the box
+void FindClusters(Boid* all_boids, int neighbor_total, int* num_send, int* send_displs)
 {
-    int* num_neighbor_boids = (int*) calloc(num_neighbors, sizeof(int));
-    MPI_Request* send_r = (MPI_Request*) calloc(num_neighbors, sizeof(MPI_Request));
-    MPI_Request* recv_r = (MPI_Request*) calloc(num_neighbors, sizeof(MPI_Request));
+    int j, k, changed;
+    int n_all = mynumboids + neighbor_total;
+    int total_send = 0;
+    int* recv_displs = (int*) BufferReserve(&cluster_displs, (num_neighbors + 1) * sizeof(int));
+    unsigned int* send_labels;
+
+    ClustersReset(&clusters, all_boids, n_all);
+    if (use_verlet)
+        VerletPairs(all_boids, ClustersLink, &clusters);
+    else {
+        CellListBuild(&cells, all_boids, n_all, xMin() - cutoff, xMax() + cutoff,
+                      yMin() - cutoff, yMax() + cutoff, cutoff);
+        CellListPairs(&cells, all_boids, mynumboids, cutoff, ClustersLink, &clusters);
+    }
 
-    int i, rank;
-    for (i = 0; i < num_neighbors; ++i) {
-        rank = neighbor_ranks[i];
-        MPI_Isend(&mynumboids, 1, MPI_INT, rank, ticknum, MPI_COMM_WORLD, &send_r[i]);
-        MPI_Irecv(&num_neighbor_boids[i], 1, MPI_INT, rank, ticknum, MPI_COMM_WORLD, &recv_r[i]);
+    recv_displs[0] = 0;
+    for (j = 0; j < num_neighbors; ++j) {
+        recv_displs[j + 1] = recv_displs[j] + halo_exchange.num_recv[j];
+        if (send_displs[j] + num_send[j] > total_send)
+            total_send = send_displs[j] + num_send[j];
     }
+    send_labels = (unsigned int*) BufferReserve(&cluster_labels, total_send * sizeof(unsigned int));
+
+    for (;;) {
+        changed = ClustersRelabel(&clusters, n_all, mynumboids);
+        MPI_Allreduce(MPI_IN_PLACE, &changed, 1, MPI_INT, MPI_LOR, sim_comm);
+        if (!changed)
+            break;
+
+        // Without cutoff_halo every neighbor got all the boids, in order
+        for (k = 0; k < total_send; ++k)
+            send_labels[k] = clusters.label[cutoff_halo ? halo_index[k] : k];
+        MPI_Neighbor_alltoallv(send_labels, num_send, send_displs, MPI_UNSIGNED,
+                               clusters.label + mynumboids, halo_exchange.num_recv,
+                               recv_displs, MPI_UNSIGNED, graph_comm);
+    }
+
+    ClustersWrite(&clusters, n_all, mynumboids, tick);
+}
+
 
-    MPI_Waitall(num_neighbors, send_r, MPI_STATUSES_IGNORE);
-    MPI_Waitall(num_neighbors, recv_r, MPI_STATUSES_IGNORE);
 
-    free(send_r);
-    free(recv_r);
 
-    return num_neighbor_boids;
+// Checks whether a position is close enough to the box owned by rank that some
+// boid in that box could be within cutoff of it. With Verlet lists that's
+// cutoff + skin, counted across the periodic edges too, since the lists look
+// for boids that might wrap around before the next rebuild
+int InRankHalo(Vec r, int rank)
+{
+    double box[4];
+    double point[4] = {r.x, r.x, r.y, r.y};
+    RankBox(rank, xcuts, ycuts, box);
+
+    return BoxesNear(point, box, halo_reach, use_verlet);
 }
 
 
@@ -497,42 +1470,67 @@ int* SendRecvNumBoids(int* neighbor_ranks, int num_neighbors, int ticknum)
 // Finds exactly which ranks are neighboring ranks, and how many neighboring
 // ranks you have
 //
-// Since numranks is always a power of 4, if numranks == 4, then you have 3
-// neighbors, and Otherwise you always have 8. The general assumption when
-// discussing the code above is that you have 8 neighbors
+// A neighbor is any rank whose box comes within halo_reach of yours, wrapping
+// around the edges. That is everyone that can hold a halo boid, or that a boid
+// can move to in one tick. With equal boxes it is the 8 around you, but once
+// rows have their own column cuts a row above or below can contribute more.
+// Each neighbor is listed once, and this rank never is, since both would have
+// boids exchanged more than once and counted twice
 void Neighbors(int** ranks, int* num_neighbors)
 {
-    int i, j, idx = 0;
+    int rank, idx = 0;
+    double my_box[4], box[4];
 
-    // If there are only 4 ranks, then everyone who isn't you is a neighbor
-    if (numranks == 4) {
-        *num_neighbors = 3;
-        *ranks = (int*) calloc( (*num_neighbors), sizeof(int) );
+    RankBox(myrank, xcuts, ycuts, my_box);
 
-        for (i = 0; i < 4; ++i) {
-            if (i != myrank)
-                (*ranks)[idx++] = i;
-        }
+    *ranks = (int*) CountedCalloc( numranks, sizeof(int) );
+
+    for (rank = 0; rank < numranks; ++rank) {
+        RankBox(rank, xcuts, ycuts, box);
+        if (rank != myrank && BoxesNear(my_box, box, halo_reach, 1))
+            (*ranks)[idx++] = rank;
     }
-    // Otherwise, you have 8 unique neighbors, since numranks = 4^n
-    else {
-        int xnew, ynew;
-        int xquad = xQuad();
-        int yquad = yQuad();
-        int num_rank_side = NumRanksSide();
-        *num_neighbors = 8;
-        *ranks = (int*) calloc( (*num_neighbors), sizeof(int) );
-
-        for (i = -1; i <= 1; ++i) {
-            for (j = -1; j <= 1; ++j) {
-                if (i != 0 || j != 0) {
-                    xnew = mod(xquad + i, num_rank_side);
-                    ynew = mod(yquad + j, num_rank_side);
-                    (*ranks)[idx++] = QuadToRank(xnew, ynew);
-                }
-            }
+    *num_neighbors = idx;
+}
+
+
+
+
+// Fills box with {xmin, xmax, ymin, ymax} of the box rank owns under the
+// given cuts
+void RankBox(int rank, double* xc, double* yc, double* box)
+{
+    int xquad = rank % NumRanksX();
+    int yquad = rank / NumRanksX();
+    double* row = RowCuts(xc, yquad);
+
+    box[0] = row[xquad];
+    box[1] = row[xquad + 1];
+    box[2] = yc[yquad];
+    box[3] = yc[yquad + 1];
+}
+
+
+
+
+// Checks whether two boxes overlap once b is grown by margin on every side.
+// With periodic set, copies of b shifted by the box size count too
+int BoxesNear(double* a, double* b, double margin, int periodic)
+{
+    int i, j;
+    double sx, sy;
+    int shifts = periodic ? 1 : 0;
+
+    for (i = -shifts; i <= shifts; ++i) {
+        for (j = -shifts; j <= shifts; ++j) {
+            sx = i * sidelen_x;
+            sy = j * sidelen_y;
+            if (b[0] + sx - margin < a[1] && a[0] < b[1] + sx + margin &&
+                b[2] + sy - margin < a[3] && a[2] < b[3] + sy + margin)
+                return 1;
         }
     }
+    return 0;
 }
 
 
@@ -556,43 +1554,43 @@ int mod(int a, int b)
 
 
 // A bunch of functions that I would inline of IBM's XL compiler would let me
-double xGrid()
+int NumRanksX()
 {
-    return sidelen / sqrt(numranks);
+    return dims[0];
 }
-double yGrid()
+int NumRanksY()
 {
-    return sidelen / sqrt(numranks);
-}
-int NumRanksSide()
-{
-    return numranks / (int)sqrt(numranks);
+    return dims[1];
 }
 int xQuad()
 {
-    return myrank % NumRanksSide();
+    return myrank % NumRanksX();
 }
 int yQuad()
 {
-    return myrank / NumRanksSide();
+    return myrank / NumRanksX();
 }
 double xMin()
 {
-    return xQuad() * xGrid();
+    return RowCuts(xcuts, yQuad())[xQuad()];
 }
 double xMax()
 {
-    return (xQuad() + 1) * xGrid();
+    return RowCuts(xcuts, yQuad())[xQuad() + 1];
 }
 double yMin()
 {
-    return yQuad() * yGrid();
+    return ycuts[yQuad()];
 }
 double yMax()
 {
-    return (yQuad() + 1) * yGrid();
+    return ycuts[yQuad() + 1];
+}
+double* RowCuts(double* xc, int y)
+{
+    return xc + y * (NumRanksX() + 1);
 }
 int QuadToRank(int x, int y)
 {
-    return x + NumRanksSide() * y;
+    return x + NumRanksX() * y;
 }
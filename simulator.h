@@ -7,10 +7,26 @@
 /* Iterates through timestep passed into function */
 void Iterate(int);
 
+/* Writes out the boids for a tick */
+void WriteOutput(int);
+
+/* Finishes up output once the run is over */
+void FinalizeSim(void);
+
+/* Writes a checkpoint to restart from at a tick */
+void CheckpointSim(Config*, int);
+
+/* Whether the run should checkpoint and stop */
+int StopRequested(void);
+
 /* Wrapping modulus function */
 int mod(int, int);
 
-/* Checks to make sure simulation is running bug-free */
+/* Level 1 sanity checks look at one boid in this many */
+#define CHECK_SAMPLE 16
+
+/* Checks to make sure simulation is running bug-free, as often and as thoroughly as
+   check_level says */
 void SanityCheck(void);
 
 /* Finds and returns the index the rank in a list of neighboring ranks */
@@ -19,38 +35,96 @@ int IndexOf(int*, int, int);
 /* Finds who the neighbors of a rank are */
 void Neighbors(int**, int*);
 
+/* Finds the box a rank owns under a set of cuts */
+void RankBox(int, double*, double*, double*);
+
+/* Checks whether two boxes are within some distance of each other */
+int BoxesNear(double*, double*, double, int);
+
+/* Sets up the graph communicator and exchanges over the neighbor ranks */
+void BuildGraph(void);
+
+
+/* Histogram bins per rank along each axis used to place rank boundaries */
+#define BALANCE_BINS 64
+
+/* Moves the rank boundaries so every rank holds about the same number of boids */
+void Rebalance(int);
+
+/* Lists the ranks boids can move between when the rank boundaries change */
+void MovedNeighbors(double*, double*, int**, int*);
+
+/* Places cut lines so each slice holds the same share of a histogram */
+void BalanceCuts(int*, int, double, double*, int);
+
+/* Finds which slice between cut lines a coordinate is in */
+int CutIndex(double*, int, double);
+
+/* Largest rank's boid count over the average */
+double Imbalance(void);
+
+/* Which local boids SumNeighbors works on */
+#define ALL_BOIDS 0
+#define INTERIOR_BOIDS 1
+#define BOUNDARY_BOIDS 2
+
 /* Goes through all the boids and updates the velocities */
 void UpdateVelocity(Boid*, int);
 
-/* Finds the total number of neighboring boids */
-int TotalNeighborBoids(int*, int);
+/* Averages the velocities of each boid's neighbors */
+void SumNeighbors(Boid*, int, int);
+
+/* Lists each local boid's neighbors within cutoff + verlet_skin, to reuse until some boid
+   has moved more than verlet_skin / 2 */
+void BuildVerletLists(Boid*, int);
 
-/* Calculates Tamas's statistic */
-double AverageNormalizedVelocity(void);
+/* Calls a function for every pair of boids within cutoff in the Verlet lists */
+void VerletPairs(Boid*, void (*)(int, int, void*), void*);
+
+/* Points boids along their neighbors' average velocity, plus noise */
+void AlignVelocities(void);
+
+/* Checks that a position is further than cutoff from every edge of the rank */
+int IsInterior(Vec);
 
 /* Concatenates all neighbor boids for easy iteration */
 Boid* ConcatenateBoids(Boid*, int);
 
 /* Updates positions of all boids in accordance with velocity */
-void UpdatePosition(int*, int, int);
-
-/* Sends and receives how many boids each rank should expect */
-int* SendRecvNumBoids(int*, int, int);
+void UpdatePosition(void);
 
 /* Checks that a position is within proper boundarys of the rank */
 int CheckLocalBoundaries(double, double);
 
 /* Sends and receives actual neighbor boids */
-Boid* SendRecvBoids(int*, int*, int, int);
+Boid* SendRecvBoids(Boid*, int*, int*, int*);
 
-/* If a boid is outside of its proper rank space, move it to the right rank */
-void RearrangeBoids(int*, int*, int*, int, int);
+/* Picks out the boids each neighbor rank needs for its velocity update */
+Boid* PackHaloBoids(int**, int**);
+
+/* Finds clusters of boids and writes their sizes */
+void FindClusters(Boid*, int, int*, int*);
+
+/* Checks whether a position is within cutoff (plus verlet_skin) of a rank's box */
+int InRankHalo(Vec, int);
+
+/* Sends every boid outside this rank's box to the rank that owns it */
+void MigrateBoids(void);
+
+/* Sends the listed boids, which are outside of their proper rank space, to the right ranks */
+void RearrangeBoids(int*, int);
 
 /* Initializes simulation static variables */
-void InitializeSim(Boid*, Config*, int, int, int);
+void InitializeSim(Boid*, Config*, int, int, int, MPI_Comm);
+
+/* Removes the boids that left and appends the ones neighbor ranks sent */
+void RecombineBoids(int*, int);
+
+/* Grows the per-tick buffers ahead of what the warmup ticks needed */
+void GrowBuffers(void);
 
-/* If a rank has received new boids from a neighbor rank, put these new boids into the boid array */
-void RecombineBoids(Boid**, int*, int*, int, int, int);
+/* Sorts boids by where they are in the rank's box */
+void SortBoids(void);
 
 /* Trivial functions that should be inlined, but IBM's XL compiler won't let me */
 int xQuad(void);
@@ -59,9 +133,9 @@ double xMin(void);
 double xMax(void);
 double yMin(void);
 double yMax(void);
-double xGrid(void);
-double yGrid(void);
-int NumRanksSide(void);
+int NumRanksX(void);
+int NumRanksY(void);
+double* RowCuts(double*, int);
 int QuadToRank(int, int);
 
 #endif
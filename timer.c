@@ -0,0 +1,151 @@
+#include "timer.h"
+#include "arena.h"
+#include <stdio.h>
+#include <math.h>
+
+static const char* phase_names[NUM_PHASES] = {
+    "halo pack", "halo exchange", "concatenate", "output", "velocity", "clusters",
+    "position", "migration", "balance", "analytics", "sanity check"
+};
+
+static double last;
+static double tick_time[NUM_PHASES];
+static double total[NUM_PHASES];
+static long long histogram[NUM_PHASES][TIMER_BUCKETS];
+static long long last_allocations;
+static long long tick_allocations[NUM_PHASES];
+static long long allocations[NUM_PHASES + 1];
+static int ticks;
+
+void
+TimerMark(void)
+{
+    last = MPI_Wtime();
+    last_allocations = HeapAllocations();
+}
+
+void
+TimerLap(int phase)
+{
+    double now = MPI_Wtime();
+    long long a = HeapAllocations();
+
+    tick_time[phase] += now - last;
+    tick_allocations[phase] += a - last_allocations;
+    last = now;
+    last_allocations = a;
+}
+
+/* Bucket b holds times in [2^(b + TIMER_FIRST_BUCKET - 1), 2^(b + TIMER_FIRST_BUCKET)) */
+static int
+Bucket(double t)
+{
+    int e;
+
+    if (t <= 0.0)
+        return 0;
+    frexp(t, &e);
+    e -= TIMER_FIRST_BUCKET;
+    return e < 0 ? 0 : (e >= TIMER_BUCKETS ? TIMER_BUCKETS - 1 : e);
+}
+
+/*
+ * Phases that didn't run this tick aren't counted in the histogram. The last slot of
+ * allocations holds those made after the warmup ticks
+ */
+void
+TimerTickEnd(void)
+{
+    int p;
+
+    for (p = 0; p < NUM_PHASES; ++p) {
+        if (tick_time[p] > 0.0) {
+            total[p] += tick_time[p];
+            histogram[p][Bucket(tick_time[p])]++;
+        }
+        allocations[p] += tick_allocations[p];
+        if (ticks >= TIMER_WARMUP_TICKS)
+            allocations[NUM_PHASES] += tick_allocations[p];
+        tick_time[p] = 0.0;
+        tick_allocations[p] = 0;
+    }
+    ++ticks;
+}
+
+/* Upper edge of the bucket holding the q'th fraction of the ticks counted in h */
+static double
+Percentile(long long* h, double q)
+{
+    int b;
+    long long n = 0, seen = 0;
+
+    for (b = 0; b < TIMER_BUCKETS; ++b)
+        n += h[b];
+    if (n == 0)
+        return 0.0;
+
+    for (b = 0; b < TIMER_BUCKETS; ++b) {
+        seen += h[b];
+        if (seen >= q * n)
+            break;
+    }
+    return ldexp(1.0, b + TIMER_FIRST_BUCKET);
+}
+
+/*
+ * Totals go through MIN, MAX and SUM reductions, histograms are summed. Imbalance is the
+ * slowest rank over the average, so 1 is perfectly even. Percentiles are per rank per
+ * tick, and only good to a factor of two, since they come from the histograms. Heap
+ * allocations are added up over ranks. Boid updates per second go by the slowest rank's
+ * total, since every tick waits on it
+ */
+void
+TimerReport(int numboids, MPI_Comm comm)
+{
+    int p, myrank, numranks;
+    double mine[NUM_PHASES + 1], lo[NUM_PHASES + 1], hi[NUM_PHASES + 1], sum[NUM_PHASES + 1];
+    long long all_histograms[NUM_PHASES][TIMER_BUCKETS];
+    long long all_allocations[NUM_PHASES + 1];
+    double mean;
+
+    MPI_Comm_rank(comm, &myrank);
+    MPI_Comm_size(comm, &numranks);
+
+    mine[NUM_PHASES] = 0.0;
+    for (p = 0; p < NUM_PHASES; ++p) {
+        mine[p] = total[p];
+        mine[NUM_PHASES] += total[p];
+    }
+
+    MPI_Reduce(mine, lo, NUM_PHASES + 1, MPI_DOUBLE, MPI_MIN, 0, comm);
+    MPI_Reduce(mine, hi, NUM_PHASES + 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(mine, sum, NUM_PHASES + 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(histogram, all_histograms, NUM_PHASES * TIMER_BUCKETS, MPI_LONG_LONG, MPI_SUM,
+               0, comm);
+    MPI_Reduce(allocations, all_allocations, NUM_PHASES + 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+
+    if (myrank != 0)
+        return;
+
+    printf("%-14s %10s %10s %10s %9s %10s %10s %8s\n", "Phase", "min (s)", "mean (s)",
+           "max (s)", "imbalance", "tick p50", "tick p99", "allocs");
+    for (p = 0; p <= NUM_PHASES; ++p) {
+        mean = sum[p] / numranks;
+        if (p < NUM_PHASES && hi[p] == 0.0)
+            continue;
+        printf("%-14s %10.4f %10.4f %10.4f %9.2f", p < NUM_PHASES ? phase_names[p] : "total",
+               lo[p], mean, hi[p], mean > 0.0 ? hi[p] / mean : 1.0);
+        if (p < NUM_PHASES)
+            printf(" %10.2e %10.2e %8lld", Percentile(all_histograms[p], 0.5),
+                   Percentile(all_histograms[p], 0.99), all_allocations[p]);
+        printf("\n");
+    }
+
+    if (ticks > TIMER_WARMUP_TICKS)
+        printf("%lld heap allocations after the first %i ticks\n", all_allocations[NUM_PHASES],
+               TIMER_WARMUP_TICKS);
+
+    if (hi[NUM_PHASES] > 0.0)
+        printf("%i ticks of %i boids on %i ranks, %.4g boid updates per second\n", ticks,
+               numboids, numranks, (double) numboids * ticks / hi[NUM_PHASES]);
+}
@@ -0,0 +1,47 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <mpi.h>
+
+/* Per-phase timers for Iterate. The phases of a tick run one after another,
+   so rather than starting and stopping each one, TimerLap charges whatever
+   time has passed since the previous lap to a phase. Each rank keeps a total
+   per phase, and a histogram of how long the phase took each tick. Heap
+   allocations counted by arena.h are charged to phases the same way */
+
+#define PHASE_HALO_PACK 0
+#define PHASE_HALO_EXCHANGE 1
+#define PHASE_CONCATENATE 2
+#define PHASE_OUTPUT 3
+#define PHASE_VELOCITY 4
+#define PHASE_CLUSTERS 5
+#define PHASE_POSITION 6
+#define PHASE_MIGRATION 7
+#define PHASE_BALANCE 8
+#define PHASE_ANALYTICS 9
+#define PHASE_SANITY 10
+#define NUM_PHASES 11
+
+/* Per-tick histograms have one bucket per power of two seconds, from about a
+   microsecond up */
+#define TIMER_BUCKETS 32
+#define TIMER_FIRST_BUCKET -20
+
+/* Ticks in which buffers are still expected to be growing. Allocations after
+   these are reported separately */
+#define TIMER_WARMUP_TICKS 10
+
+/* Starts timing a tick */
+void TimerMark(void);
+
+/* Charges the time since the last mark or lap to a phase */
+void TimerLap(int);
+
+/* Ends a tick, adding each phase's time for it to its histogram */
+void TimerTickEnd(void);
+
+/* Prints min, mean and max across ranks of every phase, the imbalance, per-tick
+   percentiles, heap allocations and boid updates per second. Collective */
+void TimerReport(int, MPI_Comm);
+
+#endif
@@ -0,0 +1,118 @@
+#include "trajread.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static void
+Usage(void)
+{
+    fprintf(stderr,
+            "Usage: trajcat [-i] [-t first[:last]] [-n lo:hi] [-x lo:hi] [-y lo:hi] file\n"
+            "  -i   Print the file's boid count, box and ticks, and nothing else\n"
+            "  -t   Ticks to print. Every tick if not given\n"
+            "  -n   Only boids with ids in this range\n"
+            "  -x   Only boids with x in this range\n"
+            "  -y   Only boids with y in this range\n"
+            "Works on both text and binary output. Prints pflock's text format\n");
+    exit(1);
+}
+
+/* Parses "lo:hi", or a single value when one is allowed */
+static void
+ParseRange(const char* arg, double* lo, double* hi, int single)
+{
+    const char* colon = strchr(arg, ':');
+
+    *lo = atof(arg);
+    if (colon)
+        *hi = atof(colon + 1);
+    else if (single)
+        *hi = *lo;
+    else
+        Usage();
+}
+
+/*
+ * Prints the selected part of a trajectory. Only the frames asked for are looked up in
+ * the index and read, so pulling one tick out of the end of a long run is immediate
+ */
+int
+main(int argc, char** argv)
+{
+    TrajFile* t;
+    TrajQuery q;
+    TrajRecord* out;
+    double lo, hi, first = 0, last = -1;
+    long f, f_first, f_last;
+    size_t i, n;
+    int opt, info = 0, ticks = 0;
+
+    TrajQueryAll(&q);
+    while ((opt = getopt(argc, argv, "it:n:x:y:")) != -1) {
+        switch (opt) {
+        case 'i':
+            info = 1;
+            break;
+        case 't':
+            ParseRange(optarg, &first, &last, 1);
+            ticks = 1;
+            break;
+        case 'n':
+            ParseRange(optarg, &lo, &hi, 1);
+            q.id_lo = (uint32_t) lo;
+            q.id_hi = (uint32_t) hi;
+            break;
+        case 'x':
+            ParseRange(optarg, &q.x_lo, &q.x_hi, 0);
+            break;
+        case 'y':
+            ParseRange(optarg, &q.y_lo, &q.y_hi, 0);
+            break;
+        default:
+            Usage();
+        }
+    }
+    if (optind != argc - 1)
+        Usage();
+
+    t = TrajFileOpen(argv[optind]);
+    if (!t)
+        return 1;
+
+    if (info) {
+        printf("%s, %llu boids, %llu frames", t->binary ? "binary" : "text",
+               (unsigned long long) t->numboids, (unsigned long long) t->numframes);
+        if (t->numframes > 0)
+            printf(", ticks %llu to %llu", (unsigned long long) t->frames[0].tick,
+                   (unsigned long long) t->frames[t->numframes - 1].tick);
+        if (t->binary)
+            printf(", box %g x %g, dt %g", t->sidelen_x, t->sidelen_y, t->dt);
+        printf("\n");
+        TrajFileClose(t);
+        return 0;
+    }
+
+    /* Ticks may not all be there, so the range is narrowed to the frames inside it */
+    f_first = 0;
+    f_last = (long) t->numframes - 1;
+    if (ticks) {
+        f_first = TrajFileSeek(t, (uint64_t) first);
+        f_last = TrajFileSeek(t, (uint64_t) last + 1) - 1;
+        if (first == last && TrajFileFind(t, (uint64_t) first) < 0)
+            fprintf(stderr, "Tick %.0f is not in %s\n", first, argv[optind]);
+    }
+
+    out = (TrajRecord*) malloc( (t->numboids > 0 ? t->numboids : 1) * sizeof(TrajRecord) );
+    for (f = f_first; f <= f_last; ++f) {
+        n = TrajFileRead(t, f, &q, out);
+        printf("%zu\n# Time step = %llu\n", n, (unsigned long long) t->frames[f].tick);
+        for (i = 0; i < n; ++i)
+            printf("%u %f %f 0.0 %f %f 0.0\n", out[i].id, out[i].x, out[i].y, out[i].vx,
+                   out[i].vy);
+    }
+
+    free(out);
+    TrajFileClose(t);
+    return 0;
+}
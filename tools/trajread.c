@@ -0,0 +1,350 @@
+#include "trajread.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <float.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INDEX_MAGIC "PFLOCKIX"
+#define INDEX_VERSION 1
+#define TIME_STEP "# Time step = "
+
+/* Header of a text file's saved index, followed by its TrajFrames */
+typedef struct indexheader_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t pad;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t numboids;
+    uint64_t numframes;
+} IndexHeader;
+
+/*
+ * Reads an unsigned number at *p, not going past end, and leaves *p after it. Returns
+ * 0 if there were no digits
+ */
+static int
+ParseUnsigned(const char** p, const char* end, uint64_t* v)
+{
+    const char* s = *p;
+
+    *v = 0;
+    while (s < end && *s >= '0' && *s <= '9')
+        *v = *v * 10 + (*s++ - '0');
+
+    if (s == *p)
+        return 0;
+    *p = s;
+    return 1;
+}
+
+/*
+ * Reads the next space separated number at *p. The mapping isn't nul terminated, and
+ * the last line of a text file has no newline, so the number is copied out for strtod
+ */
+static double
+ParseDouble(const char** p, const char* end)
+{
+    char number[512];
+    const char* s = *p;
+    int len = 0;
+
+    while (s < end && *s == ' ')
+        ++s;
+    while (s < end && *s != ' ' && *s != '\n' && len < (int) sizeof(number) - 1)
+        number[len++] = *s++;
+    number[len] = '\0';
+
+    *p = s;
+    return strtod(number, NULL);
+}
+
+/*
+ * Builds a text file's index. Boid lines never hold a '#', so every one is the start
+ * of a "# Time step = " header, and the frame starts on the line after it
+ */
+static int
+ScanText(TrajFile* t)
+{
+    const char* end = t->data + t->size;
+    const char* p = t->data;
+    size_t capacity = 0;
+    size_t len = strlen(TIME_STEP);
+    uint64_t tick;
+
+    if (!ParseUnsigned(&p, end, &t->numboids))
+        return 0;
+
+    t->numframes = 0;
+    while ((p = (const char*) memchr(p, '#', end - p)) != NULL) {
+        if ((size_t) (end - p) < len || memcmp(p, TIME_STEP, len) != 0) {
+            ++p;
+            continue;
+        }
+
+        p += len;
+        if (!ParseUnsigned(&p, end, &tick))
+            continue;
+        p = (const char*) memchr(p, '\n', end - p);
+        p = p ? p + 1 : end;
+
+        if (t->numframes == capacity) {
+            capacity = capacity ? 2 * capacity : 1024;
+            t->frames = (TrajFrame*) realloc(t->frames, capacity * sizeof(TrajFrame));
+        }
+        t->frames[t->numframes].tick = tick;
+        t->frames[t->numframes].offset = p - t->data;
+        ++t->numframes;
+    }
+
+    return t->numframes > 0;
+}
+
+/* Loads a saved text index, if there is one and it was made for this exact file */
+static int
+LoadIndex(TrajFile* t, const char* iname, struct stat* st)
+{
+    IndexHeader h;
+    FILE* f = fopen(iname, "rb");
+    int ok = 0;
+
+    if (f && fread(&h, sizeof(IndexHeader), 1, f) == 1 &&
+        memcmp(h.magic, INDEX_MAGIC, 8) == 0 && h.version == INDEX_VERSION &&
+        h.size == (uint64_t) st->st_size && h.mtime == (int64_t) st->st_mtime) {
+        t->numboids = h.numboids;
+        t->numframes = h.numframes;
+        t->frames = (TrajFrame*) malloc( (h.numframes > 0 ? h.numframes : 1) * sizeof(TrajFrame) );
+        ok = fread(t->frames, sizeof(TrajFrame), h.numframes, f) == h.numframes;
+    }
+
+    if (f)
+        fclose(f);
+    return ok;
+}
+
+/* Saves a text index for next time. Not being able to is fine, it just gets rebuilt */
+static void
+SaveIndex(TrajFile* t, const char* iname, struct stat* st)
+{
+    IndexHeader h;
+    FILE* f = fopen(iname, "wb");
+
+    if (!f)
+        return;
+
+    memset(&h, 0, sizeof(IndexHeader));
+    memcpy(h.magic, INDEX_MAGIC, 8);
+    h.version = INDEX_VERSION;
+    h.size = st->st_size;
+    h.mtime = st->st_mtime;
+    h.numboids = t->numboids;
+    h.numframes = t->numframes;
+
+    if (fwrite(&h, sizeof(IndexHeader), 1, f) != 1 ||
+        fwrite(t->frames, sizeof(TrajFrame), t->numframes, f) != t->numframes) {
+        fclose(f);
+        remove(iname);
+        return;
+    }
+    fclose(f);
+}
+
+/*
+ * Takes the header and index of a binary file. A run that died before TrajClose left
+ * the index offset at 0, but frames are all the same size and one was written per tick,
+ * so the complete ones can still be found
+ */
+static int
+OpenBinary(TrajFile* t)
+{
+    TrajHeader h;
+    uint64_t f, frame_bytes;
+
+    if (t->size < sizeof(TrajHeader))
+        return 0;
+    memcpy(&h, t->data, sizeof(TrajHeader));
+    if (h.version != TRAJ_VERSION || h.record_size != sizeof(TrajRecord))
+        return 0;
+
+    t->numboids = h.numboids;
+    t->sidelen_x = h.sidelen_x;
+    t->sidelen_y = h.sidelen_y;
+    t->dt = h.dt;
+    frame_bytes = h.numboids * sizeof(TrajRecord);
+
+    if (h.index_offset > 0 && h.index_offset + h.numframes * sizeof(TrajFrame) <= t->size) {
+        t->numframes = h.numframes;
+        t->frames = (TrajFrame*) malloc( (h.numframes > 0 ? h.numframes : 1) * sizeof(TrajFrame) );
+        memcpy(t->frames, t->data + h.index_offset, h.numframes * sizeof(TrajFrame));
+    }
+    else {
+        t->numframes = frame_bytes > 0 ? (t->size - sizeof(TrajHeader)) / frame_bytes : 0;
+        t->frames = (TrajFrame*) malloc( (t->numframes > 0 ? t->numframes : 1) * sizeof(TrajFrame) );
+        for (f = 0; f < t->numframes; ++f) {
+            t->frames[f].tick = f;
+            t->frames[f].offset = sizeof(TrajHeader) + f * frame_bytes;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Maps the file read only. Access is by frame, so the kernel is told not to read ahead
+ * more than it has to
+ */
+TrajFile*
+TrajFileOpen(const char* fname)
+{
+    TrajFile* t = (TrajFile*) calloc(1, sizeof(TrajFile));
+    char* iname = (char*) malloc( strlen(fname) + 5 );
+    struct stat st;
+    int fd = open(fname, O_RDONLY);
+    int ok = 0;
+
+    sprintf(iname, "%s.idx", fname);
+
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        t->size = st.st_size;
+        t->data = (const char*) mmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (t->data == MAP_FAILED)
+            t->data = NULL;
+    }
+    if (fd >= 0)
+        close(fd);
+
+    if (!t->data)
+        fprintf(stderr, "Could not map %s\n", fname);
+    else {
+        madvise((void*) t->data, t->size, MADV_RANDOM);
+
+        t->binary = t->size >= 8 && memcmp(t->data, TRAJ_MAGIC, 8) == 0;
+        if (t->binary)
+            ok = OpenBinary(t);
+        else if (LoadIndex(t, iname, &st))
+            ok = 1;
+        else {
+            free(t->frames);
+            t->frames = NULL;
+            ok = ScanText(t);
+            if (ok)
+                SaveIndex(t, iname, &st);
+        }
+
+        if (!ok)
+            fprintf(stderr, "%s is not a trajectory this version can read\n", fname);
+    }
+
+    free(iname);
+    if (!ok) {
+        TrajFileClose(t);
+        return NULL;
+    }
+    return t;
+}
+
+void
+TrajFileClose(TrajFile* t)
+{
+    if (t->data)
+        munmap((void*) t->data, t->size);
+    free(t->frames);
+    free(t);
+}
+
+/* Binary search, since frames are in tick order */
+long
+TrajFileSeek(TrajFile* t, uint64_t tick)
+{
+    long lo = 0, hi = (long) t->numframes, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (t->frames[mid].tick < tick)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+long
+TrajFileFind(TrajFile* t, uint64_t tick)
+{
+    long f = TrajFileSeek(t, tick);
+    return (uint64_t) f < t->numframes && t->frames[f].tick == tick ? f : -1;
+}
+
+void
+TrajQueryAll(TrajQuery* q)
+{
+    q->id_lo = 0;
+    q->id_hi = UINT32_MAX;
+    q->x_lo = q->y_lo = -DBL_MAX;
+    q->x_hi = q->y_hi = DBL_MAX;
+}
+
+/*
+ * Records within a frame are in rank order, not id or position order, so the whole
+ * frame is looked through, but nothing outside it. Text lines are "id x y z vx vy vz",
+ * and the rest of a line is only parsed once the id and position pass
+ */
+size_t
+TrajFileRead(TrajFile* t, long frame, TrajQuery* q, TrajRecord* out)
+{
+    const char* p;
+    const char* end;
+    const TrajRecord* r;
+    uint64_t i, id;
+    size_t n = 0;
+    TrajRecord rec;
+
+    if (frame < 0 || (uint64_t) frame >= t->numframes)
+        return 0;
+
+    if (t->binary) {
+        r = (const TrajRecord*) (t->data + t->frames[frame].offset);
+        for (i = 0; i < t->numboids; ++i) {
+            if (r[i].id >= q->id_lo && r[i].id <= q->id_hi &&
+                r[i].x >= q->x_lo && r[i].x <= q->x_hi &&
+                r[i].y >= q->y_lo && r[i].y <= q->y_hi)
+                out[n++] = r[i];
+        }
+        return n;
+    }
+
+    p = t->data + t->frames[frame].offset;
+    end = (uint64_t) frame + 1 < t->numframes ? t->data + t->frames[frame + 1].offset
+                                              : t->data + t->size;
+    while (p < end) {
+        const char* eol = (const char*) memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+
+        /* The next frame's count and header lines aren't boids, and have no space after
+           the first number */
+        if (ParseUnsigned(&p, eol, &id) && p < eol && *p == ' ' &&
+            id >= q->id_lo && id <= q->id_hi) {
+            rec.id = (uint32_t) id;
+            rec.pad = 0;
+            rec.x = ParseDouble(&p, eol);
+            rec.y = ParseDouble(&p, eol);
+            if (rec.x >= q->x_lo && rec.x <= q->x_hi && rec.y >= q->y_lo && rec.y <= q->y_hi &&
+                n < t->numboids) {
+                ParseDouble(&p, eol);
+                rec.vx = ParseDouble(&p, eol);
+                rec.vy = ParseDouble(&p, eol);
+                out[n++] = rec;
+            }
+        }
+
+        p = eol + 1;
+    }
+
+    return n;
+}
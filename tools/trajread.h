@@ -0,0 +1,57 @@
+#ifndef _TRAJREAD_H_
+#define _TRAJREAD_H_
+
+#include "../trajfmt.h"
+#include <stddef.h>
+
+/* Random access reader for pflock output, in either the text format or the
+   binary format from trajfmt.h. The file is mmapped, and only the frames that
+   are asked for are ever touched. Needs no MPI.
+
+   Binary files carry their own frame index, or have fixed size frames when the
+   run died before writing it. Text files are scanned for their headers once,
+   and the index is saved next to the file as <file>.idx, to be loaded instead
+   of scanning as long as the file's size and modification time still match */
+
+typedef struct trajfile_s {
+    int binary;
+    const char* data;
+    size_t size;
+    uint64_t numboids;
+    uint64_t numframes;
+    TrajFrame* frames;      /* Ticks in order. Offsets are of the frame's first boid */
+    double sidelen_x;       /* Box size and dt are 0 for text files */
+    double sidelen_y;
+    double dt;
+} TrajFile;
+
+/* Which records of a frame to return. Ranges are inclusive */
+typedef struct trajquery_s {
+    uint32_t id_lo;
+    uint32_t id_hi;
+    double x_lo;
+    double x_hi;
+    double y_lo;
+    double y_hi;
+} TrajQuery;
+
+/* Maps a trajectory file and gets its index. NULL, with a message, on failure */
+TrajFile* TrajFileOpen(const char*);
+
+/* Unmaps and frees it */
+void TrajFileClose(TrajFile*);
+
+/* Index of the first frame at or after a tick, or numframes if there is none */
+long TrajFileSeek(TrajFile*, uint64_t);
+
+/* Index of the frame holding a tick, or -1 */
+long TrajFileFind(TrajFile*, uint64_t);
+
+/* Sets a query that matches everything */
+void TrajQueryAll(TrajQuery*);
+
+/* Copies the records of a frame that match the query into out, which has room
+   for numboids, and returns how many there were */
+size_t TrajFileRead(TrajFile*, long, TrajQuery*, TrajRecord*);
+
+#endif
@@ -0,0 +1,209 @@
+#include "traj.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+/*
+ * State of the open trajectory file. Kept in statics since there is only ever one per
+ * run, same as the text writer's offset
+ */
+static MPI_Comm comm;
+static MPI_File fh;
+static TrajHeader header;
+static int myrank;
+static int frames_per_write;
+static int pending;
+static int* pending_counts;
+static int* pending_ticks;
+static TrajRecord* records;
+static int records_used;
+static int records_capacity;
+static int records_peak;
+static TrajFrame* frames;
+static int frames_capacity;
+static int* flush_before;
+static MPI_Aint* flush_displs;
+static MPI_Datatype record_type;
+
+/* Writes the buffered frames */
+static void TrajFlush(void);
+
+/*
+ * Opens fname once for the whole run on comm, and has its rank 0 write the header. The
+ * frame count and index offset are filled in by TrajClose, so a file from a run that died
+ * early has them at 0. Up to per_write ticks are held in memory between writes.
+ *
+ * Frames are all the same size and one is written every tick, so a run restarted at
+ * first_tick keeps the frames before it, drops any after, and rebuilds their index
+ */
+void
+TrajOpen(char* fname, int numboids, int numticks, double sidelen_x, double sidelen_y,
+         double dt, int per_write, int first_tick, MPI_Comm c)
+{
+    int f;
+
+    comm = c;
+    MPI_Comm_rank(comm, &myrank);
+
+    frames_per_write = per_write > 0 ? per_write : 1;
+    pending = 0;
+    pending_counts = (int*) malloc( frames_per_write * sizeof(int) );
+    pending_ticks = (int*) malloc( frames_per_write * sizeof(int) );
+    flush_before = (int*) malloc( frames_per_write * sizeof(int) );
+    flush_displs = (MPI_Aint*) malloc( frames_per_write * sizeof(MPI_Aint) );
+    records = NULL;
+    records_used = 0;
+    records_capacity = 0;
+    records_peak = 0;
+    MPI_Type_contiguous(sizeof(TrajRecord), MPI_BYTE, &record_type);
+    MPI_Type_commit(&record_type);
+
+    /* The index has room for every tick of the run from the start, so writing never
+       has to grow it */
+    frames_capacity = (numticks > first_tick ? numticks : first_tick) + 1;
+    frames = (TrajFrame*) malloc( frames_capacity * sizeof(TrajFrame) );
+
+    memset(&header, 0, sizeof(TrajHeader));
+    memcpy(header.magic, TRAJ_MAGIC, 8);
+    header.version = TRAJ_VERSION;
+    header.record_size = sizeof(TrajRecord);
+    header.numboids = numboids;
+    header.numticks = numticks;
+    header.sidelen_x = sidelen_x;
+    header.sidelen_y = sidelen_y;
+    header.dt = dt;
+
+    if (first_tick > 0) {
+        for (f = 0; f < first_tick; ++f) {
+            frames[f].tick = f;
+            frames[f].offset = sizeof(TrajHeader) + (uint64_t) f * numboids * sizeof(TrajRecord);
+        }
+        header.numframes = first_tick;
+    }
+
+    MPI_File_open(comm, fname, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    MPI_File_set_size(fh, sizeof(TrajHeader) + header.numframes * numboids * sizeof(TrajRecord));
+    if (myrank == 0)
+        MPI_File_write_at(fh, 0, &header, sizeof(TrajHeader), MPI_BYTE, MPI_STATUS_IGNORE);
+}
+
+/*
+ * Copies this rank's boids for ticknum into the buffer. Once frames_per_write ticks are
+ * buffered, they all go out in one collective write
+ */
+void
+TrajWrite(Boid* boids, int n, int ticknum)
+{
+    int i;
+    TrajRecord* r;
+
+    if (records_used + n > records_peak)
+        records_peak = records_used + n;
+    if (records_used + n > records_capacity) {
+        records_capacity = records_used + n + (records_used + n) / 2;
+        records = (TrajRecord*) CountedRealloc(records, records_capacity * sizeof(TrajRecord));
+    }
+
+    r = records + records_used;
+    #pragma omp parallel for
+    for (i = 0; i < n; ++i) {
+        r[i].id = boids[i].id;
+        r[i].pad = 0;
+        r[i].x = boids[i].r.x;
+        r[i].y = boids[i].r.y;
+        r[i].vx = boids[i].v.x;
+        r[i].vy = boids[i].v.y;
+    }
+    records_used += n;
+
+    pending_counts[pending] = n;
+    pending_ticks[pending] = ticknum;
+    if (++pending == frames_per_write)
+        TrajFlush();
+}
+
+void
+TrajGrow(void)
+{
+    if (records_capacity == 0 || GROW_HEADROOM * records_peak <= records_capacity)
+        return;
+
+    records_capacity = GROW_HEADROOM * records_peak;
+    records = (TrajRecord*) CountedRealloc(records, records_capacity * sizeof(TrajRecord));
+}
+
+/*
+ * Every frame is numboids records long, so frame f starts at a fixed place, and a rank's
+ * part of it starts after the records of all lower ranks. One MPI_Exscan finds that for
+ * every buffered frame at once. The pieces are described by an hindexed file view, so
+ * all of them go out in a single MPI_File_write_at_all. Lengths and counts are in
+ * records and offsets are 64 bit, so none of them overflow an int
+ */
+static void
+TrajFlush(void)
+{
+    int f;
+    int* before = flush_before;
+    MPI_Aint* displs = flush_displs;
+    MPI_Offset frame_bytes = (MPI_Offset) header.numboids * sizeof(TrajRecord);
+    MPI_Offset base;
+    MPI_Datatype view;
+
+    MPI_Exscan(pending_counts, before, pending, MPI_INT, MPI_SUM, comm);
+    if (myrank == 0)
+        memset(before, 0, frames_per_write * sizeof(int));
+
+    if ((int) header.numframes + pending > frames_capacity) {
+        frames_capacity = 2 * ((int) header.numframes + pending);
+        frames = (TrajFrame*) CountedRealloc(frames, frames_capacity * sizeof(TrajFrame));
+    }
+
+    for (f = 0; f < pending; ++f) {
+        base = sizeof(TrajHeader) + (header.numframes + f) * frame_bytes;
+        displs[f] = base + (MPI_Offset) before[f] * sizeof(TrajRecord);
+
+        frames[header.numframes + f].tick = pending_ticks[f];
+        frames[header.numframes + f].offset = base;
+    }
+
+    MPI_Type_create_hindexed(pending, pending_counts, displs, record_type, &view);
+    MPI_Type_commit(&view);
+    MPI_File_set_view(fh, 0, MPI_BYTE, view, "native", MPI_INFO_NULL);
+    MPI_File_write_at_all(fh, 0, records, records_used, record_type, MPI_STATUS_IGNORE);
+    MPI_File_set_view(fh, 0, MPI_BYTE, MPI_BYTE, "native", MPI_INFO_NULL);
+    MPI_Type_free(&view);
+
+    header.numframes += pending;
+    pending = 0;
+    records_used = 0;
+}
+
+/*
+ * Flushes whatever is left, then rank 0 appends the frame index and rewrites the header
+ * with where to find it
+ */
+void
+TrajClose(void)
+{
+    if (pending > 0)
+        TrajFlush();
+
+    header.index_offset = sizeof(TrajHeader) + header.numframes * header.numboids *
+                          sizeof(TrajRecord);
+
+    if (myrank == 0) {
+        MPI_File_write_at(fh, header.index_offset, frames, header.numframes * sizeof(TrajFrame),
+                          MPI_BYTE, MPI_STATUS_IGNORE);
+        MPI_File_write_at(fh, 0, &header, sizeof(TrajHeader), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&fh);
+
+    free(pending_counts);
+    free(pending_ticks);
+    free(flush_before);
+    free(flush_displs);
+    MPI_Type_free(&record_type);
+    free(records);
+    free(frames);
+}
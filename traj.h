@@ -0,0 +1,25 @@
+#ifndef _TRAJ_H_
+#define _TRAJ_H_
+
+#include "boid.h"
+#include "trajfmt.h"
+#include <mpi.h>
+
+/* Writer for the binary trajectory format in trajfmt.h */
+
+/* Opens the file for the whole run and writes the header. Continues an existing
+   file from a given tick when restarting. Collective */
+void TrajOpen(char*, int, int, double, double, double, int, int, MPI_Comm);
+
+/* Adds this rank's boids for a tick, writing out once enough ticks are buffered.
+   Collective */
+void TrajWrite(Boid*, int, int);
+
+/* Grows the record buffer to GROW_HEADROOM times the most it has held */
+void TrajGrow(void);
+
+/* Writes out anything still buffered, then the index, and closes the file.
+   Collective */
+void TrajClose(void);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _TRAJFMT_H_
+#define _TRAJFMT_H_
+
+#include <stdint.h>
+
+/* Binary trajectory file. A TrajHeader, then one frame per tick written, each
+   frame being numboids TrajRecords, then an index of TrajFrames, one per frame.
+   Records within a frame are grouped by rank, not sorted by id. Everything is
+   in the byte order of the machine that wrote it */
+
+#define TRAJ_MAGIC "PFLOCKTR"
+#define TRAJ_VERSION 1
+
+typedef struct trajheader_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t numboids;
+    uint64_t numticks;
+    uint64_t numframes;
+    uint64_t index_offset;
+    double sidelen_x;
+    double sidelen_y;
+    double dt;
+} TrajHeader;
+
+typedef struct trajrecord_s {
+    uint32_t id;
+    uint32_t pad;
+    double x;
+    double y;
+    double vx;
+    double vy;
+} TrajRecord;
+
+typedef struct trajframe_s {
+    uint64_t tick;
+    uint64_t offset;
+} TrajFrame;
+
+#endif
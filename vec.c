@@ -1,19 +1,5 @@
-#include "clcg4.h"
 #include "vec.h"
-#include <stdio.h>
 #include <math.h>
-#include <time.h>
-
-/* Generates a vector with a random angle and length l */
-void
-VecRandomAngle(Vec* v, double l)
-{
-    srand( time(NULL) );
-    int seed = rand() % Maxgen;
-    double a = GenVal(seed) * 2 * M_PI;
-    v->x = l * cos(a);
-    v->y = l * sin(a);
-}
 
 /* Sets the angle of a vector without changing its length */
 void
@@ -46,3 +32,42 @@ VecLength(Vec v)
 {
     return sqrt(v.x * v.x + v.y * v.y);
 }
+
+/*
+ * Batched, trig-free version of VecAngle + VecSetAngle + VecSetLength. Each vector is
+ * normalized with one sqrt and rotated by da[i] using a rotation matrix. The sin and
+ * cos of the half angle h = da / 2 come from Taylor polynomials through h^15 and h^16,
+ * and are doubled with sin(2h) = 2 s c, cos(2h) = c^2 - s^2.
+ *
+ * For |da| <= pi (noise <= 2 pi) the truncation error of the polynomials is below 6e-12,
+ * so each component of the result is within 2e-11 * l of the exact path, and the error
+ * shrinks like h^17 for the small turns normally used. A zero vector is treated as
+ * pointing along +x, which is the angle atan2 gives it
+ */
+void
+VecAlignBatch(double* restrict vx, double* restrict vy, double* restrict da, int n, double l)
+{
+    int i;
+    double h, h2, s, c, sin_a, cos_a, len, ux, uy;
+
+    #pragma omp parallel for simd private(h, h2, s, c, sin_a, cos_a, len, ux, uy)
+    for (i = 0; i < n; ++i) {
+        h = 0.5 * da[i];
+        h2 = h * h;
+        s = h * (1.0 + h2 * (-1.0 / 6 + h2 * (1.0 / 120 + h2 * (-1.0 / 5040 +
+                 h2 * (1.0 / 362880 + h2 * (-1.0 / 39916800 + h2 * (1.0 / 6227020800.0 +
+                 h2 * (-1.0 / 1307674368000.0))))))));
+        c = 1.0 + h2 * (-1.0 / 2 + h2 * (1.0 / 24 + h2 * (-1.0 / 720 + h2 * (1.0 / 40320 +
+            h2 * (-1.0 / 3628800 + h2 * (1.0 / 479001600 + h2 * (-1.0 / 87178291200.0 +
+            h2 * (1.0 / 20922789888000.0))))))));
+        sin_a = 2.0 * s * c;
+        cos_a = c * c - s * s;
+
+        len = sqrt(vx[i] * vx[i] + vy[i] * vy[i]);
+        ux = len > 0.0 ? vx[i] / len : 1.0;
+        uy = len > 0.0 ? vy[i] / len : 0.0;
+
+        vx[i] = l * (ux * cos_a - uy * sin_a);
+        vy[i] = l * (ux * sin_a + uy * cos_a);
+    }
+}
@@ -19,8 +19,8 @@ void VecSetAngle(Vec* v, double a);
 /* Sets the length of a vector without changing its angle */
 void VecSetLength(Vec* v, double l);
 
-/* Generates a vector with a random angle and length l */
-void VecRandomAngle(Vec* v, double l);
+/* Turns each (vx[i], vy[i]) by da[i] and sets its length to l, without trig */
+void VecAlignBatch(double* vx, double* vy, double* da, int n, double l);
 
 
 #endif